@@ -482,10 +482,7 @@ void draw_graph_window(Config &ctx) {
 
     float off = (1.0f - contrast_slant(set.contrast)) / 2.0f;
     degamma_ramp(lut1.data(), lut1.size(), DEFAULT_GAMMA, 8);
-    regamma_ramp(lut2.data(), lut2.size(), set.gamma, 8, 0.0f, 1.0f, off);
-
-    apply_luma(lut2.data(), lut2.size(), 8, set.luminance);
-    apply_range(lut2.data(), lut2.size(), 8, set.range.lo, std::min(set.range.hi, lut2.back() / 255.0f));
+    regamma_ramp(lut2.data(), lut2.size(), set.gamma, 8, 0.0f, 1.0f, off, set.luminance, set.range);
 
     std::array<float, 2>           linear = { 0, 1 };
     std::array<float, lut1.size()> lut1_float;
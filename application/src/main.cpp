@@ -123,22 +123,19 @@ int main(int argc, char **argv) {
         rc = fizeauInitialize();
     FZ_SCOPEGUARD([] { fizeauExit(); });
 
-    if (R_SUCCEEDED(rc))
-        config.read();
-
-    if (R_SUCCEEDED(rc))
-        rc = fizeauSetIsActive(config.active);
+    // The profile is opened from the snapshot fetched by read(), which it keeps up to date
+    FizeauState state;
+    config.state = &state;
 
     if (R_SUCCEEDED(rc))
-        fizeauSetActiveProfileId(false, config.internal_profile);
-
-    if (R_SUCCEEDED(rc))
-        fizeauSetActiveProfileId(true, config.external_profile);
+        rc = config.read(true);
 
     if (R_SUCCEEDED(rc))
         config.open_profile(appletGetOperationMode() == AppletOperationMode_Handheld ?
                             config.internal_profile : config.external_profile);
 
+    config.state = nullptr;
+
     while (fz::gfx::loop()) {
         auto slot = fz::gfx::dequeue();
 
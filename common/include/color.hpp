@@ -18,9 +18,13 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
 #include <array>
 #include <tuple>
+#include <type_traits>
 
+#include "fastmath.hpp"
+#include "simd.hpp"
 #include "types.h"
 
 namespace fz {
@@ -37,6 +41,7 @@ constexpr ColorMatrix dot(const ColorMatrix &r, const ColorMatrix &l) {
 
 ColorMatrix filter_matrix(Component filter);
 std::tuple<float, float, float> whitepoint(Temperature temperature);
+std::tuple<float, float, float> whitepoint_linear(Temperature temperature); // Table-based, with degamma already applied
 ColorMatrix hue_matrix(Hue hue);
 ColorMatrix saturation_matrix(Saturation sat);
 
@@ -44,18 +49,145 @@ Contrast contrast_slant(Contrast c);
 float degamma(float x, Gamma gamma);
 float regamma(float x, Gamma gamma);
 
+// Reference implementation, evaluating func with std::pow for each entry.
+// Negative values are clamped to 0 (see impl::quantize), which is bit-identical to the original
+// conversion on the console. On other hosts, the original output for these entries was undefined
 void gamma_ramp(float (*func)(float, Gamma), std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits, float lo, float hi, float off);
 
-[[maybe_unused]]
-static inline void degamma_ramp(std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits, float lo = 0.0f, float hi = 1.0f, float off = 0.0f) {
-    return gamma_ramp(degamma, array, size, gamma, nb_bits, lo, hi, off);
+namespace impl {
+
+// Evaluates func over the abscissas of the ramp (offset and clamped to [0, 1]), and passes the results to store(index, value).
+// Several entries are evaluated at a time when func accepts simd vectors, with the exact same output as the scalar loop,
+// which is also used in constant evaluation
+template <typename F, typename S>
+constexpr void evaluate_ramp(F &&func, S &&store, std::size_t size, float lo, float hi, float off) {
+    using V = simd::Vec<float>;
+
+    float step = (hi - lo) / (size - 1), cur = lo;
+    auto evaluate = [&](auto x) {
+        return func(simd::clamp(x + off, 0.0f, 1.0f));
+    };
+
+    std::size_t i = 0;
+    if constexpr (simd::is_vector<V> && std::is_invocable_v<F &, V>) {
+        if (!std::is_constant_evaluated()) {
+            for (; i < size - size % simd::lanes; i += simd::lanes) {
+                // Accumulate the abscissas sequentially, so they are rounded the same as in the scalar loop
+                V x = {};
+                for (std::size_t j = 0; j < simd::lanes; ++j, cur += step)
+                    x[j] = cur;
+
+                store(i, evaluate(x));
+            }
+        }
+    }
+
+    for (; i < size; ++i, cur += step)
+        store(i, evaluate(cur));
+}
+
+// Rounds normalized values to nb_bits entries.
+// Negative values (eg. in the regamma linear segment with gammas under ~1.93) are clamped to 0.
+// The original ramps converted them straight to std::uint16_t, which is undefined behavior: aarch64 saturates
+// them to 0 (fcvtzu), so the output on the console is unchanged, while x86 used to wrap them around the mask
+template <typename V>
+constexpr void quantize(std::uint16_t *array, std::size_t idx, V v, std::size_t nb_bits) {
+    std::int32_t shift = (1 << nb_bits) - 1, mask = (1 << (nb_bits + 1)) - 1;
+    auto res = simd::max(simd::round(v * static_cast<float>(shift)), 0.0f);
+    simd::store(array, idx, simd::convert<simd::Rebind<std::int32_t, V>>(res) & mask);
+}
+
+template <typename F>
+constexpr void ramp(F &&func, std::uint16_t *array, std::size_t size, std::size_t nb_bits, float lo, float hi, float off) {
+    evaluate_ramp(func, [array, nb_bits](std::size_t i, auto v) { quantize(array, i, v, nb_bits); }, size, lo, hi, off);
+}
+
+// Transfer function of regamma(), with the constants hoisted
+constexpr auto regamma_kernel(Gamma gamma) {
+    // Terms in the same order as regamma(), to get identical rounding
+    auto lin = 1.055f * fastmath::pow(0.0031308f, (1.0f - gamma) / gamma) - 17.567f, exp = 1.0f / gamma;
+    return [lin, exp](auto x) {
+        return simd::select(x <= 0.0031308f, x * lin, (1.0f + 0.055f) * fastmath::pow(x, exp) - 0.055f);
+    };
+}
+
+// Luminance scaling followed by the color range affine transform, on unrounded values.
+// The range top is clipped to the luma-adjusted value of the ramp at 1, which is given by top
+struct LumaRange {
+    float luma, scale, bias;
+
+    constexpr LumaRange(float top, Luminance luminance, ColorRange range) {
+        this->luma = std::clamp(luminance, MIN_LUMA, MAX_LUMA) + MAX_LUMA;
+
+        auto max = std::min(top * this->luma, 1.0f);
+        auto range_hi = std::min(range.hi, max);
+        auto range_lo = std::clamp(range.lo, 0.0f, range_hi);
+        range_hi = std::clamp(range_hi, range_lo, 1.0f);
+
+        this->scale = range_hi - range_lo, this->bias = range_lo * max;
+    }
+
+    template <typename V>
+    constexpr V operator()(V v) const {
+        return simd::clamp(v * this->luma, 0.0f, 1.0f) * this->scale + this->bias;
+    }
+};
+
+} // namespace impl
+
+// Same output as gamma_ramp(degamma/regamma, ...), using fastmath kernels and hoisted constants.
+// These can be evaluated at compile time
+constexpr void degamma_ramp(std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits,
+        float lo = 0.0f, float hi = 1.0f, float off = 0.0f) {
+    // Terms in the same order as degamma(), to get identical rounding
+    auto lin = fastmath::pow(0.090f, gamma);
+    impl::ramp([lin, gamma](auto x) {
+        return simd::select(x <= 0.040045f, x * 24.972f * lin, fastmath::pow((x + 0.055f) / (1.0f + 0.055f), gamma));
+    }, array, size, nb_bits, lo, hi, off);
+}
+
+constexpr void regamma_ramp(std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits,
+        float lo = 0.0f, float hi = 1.0f, float off = 0.0f) {
+    impl::ramp(impl::regamma_kernel(gamma), array, size, nb_bits, lo, hi, off);
 }
 
-[[maybe_unused]]
-static inline void regamma_ramp(std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits, float lo = 0.0f, float hi = 1.0f, float off = 0.0f) {
-    return gamma_ramp(regamma, array, size, gamma, nb_bits, lo, hi, off);
+// Fused regamma_ramp + apply_luma + apply_range, rounding each entry once.
+// The range top is clipped to the luma-adjusted value of the ramp at 1, in closed form
+constexpr void regamma_ramp(std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits, float lo, float hi, float off,
+        Luminance luma, ColorRange range) {
+    auto func = impl::regamma_kernel(gamma);
+    auto luma_range = impl::LumaRange(func(std::clamp(1.0f + off, 0.0f, 1.0f)), luma, range);
+    impl::ramp([&func, &luma_range](auto x) { return luma_range(func(x)); }, array, size, nb_bits, lo, hi, off);
+}
+
+// Staged equivalent of the fused regamma_ramp, with identical output.
+// regamma_samples evaluates the transfer function over the ramp without rounding, and returns its value at 1.
+// luma_range_ramp then applies luminance and color range to the samples, so changing either only costs one pass
+constexpr float regamma_samples(float *array, std::size_t size, Gamma gamma, float lo, float hi, float off) {
+    auto func = impl::regamma_kernel(gamma);
+    impl::evaluate_ramp(func, [array](std::size_t i, auto v) { simd::store(array, i, v); }, size, lo, hi, off);
+    return func(std::clamp(1.0f + off, 0.0f, 1.0f));
+}
+
+constexpr void luma_range_ramp(const float *samples, std::uint16_t *array, std::size_t size, std::size_t nb_bits,
+        float top, Luminance luma, ColorRange range) {
+    using V = simd::Vec<float>;
+
+    auto luma_range = impl::LumaRange(top, luma, range);
+
+    std::size_t i = 0;
+    if constexpr (simd::is_vector<V>) {
+        if (!std::is_constant_evaluated()) {
+            for (; i < size - size % simd::lanes; i += simd::lanes)
+                impl::quantize(array, i, luma_range(simd::load<V>(samples, i)), nb_bits);
+        }
+    }
+
+    for (; i < size; ++i)
+        impl::quantize(array, i, luma_range(samples[i]), nb_bits);
 }
 
+// Multi-pass reference for the fused regamma_ramp, rounding after each step
 void apply_luma(std::uint16_t *array, std::size_t size, std::size_t nb_bits, Luminance luma);
 void apply_range(std::uint16_t *array, std::size_t size, std::size_t nb_bits, float lo, float hi);
 
@@ -20,6 +20,8 @@
 #ifdef __cplusplus
 #   include "color.hpp"
 #   include "config.hpp"
+#   include "fastmath.hpp"
+#   include "simd.hpp"
 #   include "time.hpp"
 #endif // __cplusplus
 
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <array>
 #include <string_view>
 #include <switch.h>
@@ -26,6 +28,34 @@
 
 namespace fz {
 
+constexpr auto operator ==(const FizeauSettings &l, const FizeauSettings &r) {
+    return (l.temperature == r.temperature) && (l.saturation == r.saturation) && (l.hue == r.hue) &&
+        (l.contrast == r.contrast) && (l.gamma == r.gamma) && (l.luminance == r.luminance) && (l.range == r.range);
+}
+
+// Setters batched into a single request, which the sysmodule commits once.
+// Setting the same target again replaces the previous entry
+class Transaction {
+    public:
+        void set_is_active(bool is_active);
+        void set_active_profile_id(bool is_external, FizeauProfileId id);
+        void set_profile(FizeauProfileId id, const FizeauProfile &profile);
+
+        bool is_empty() const {
+            return this->count == 0;
+        }
+
+        // Sends the entries and clears them
+        Result apply();
+
+    private:
+        FizeauTransactionEntry &find_entry(FizeauTransactionOp op, FizeauProfileId id, bool is_external);
+
+    private:
+        std::array<FizeauTransactionEntry, FIZEAU_TRANSACTION_MAX_ENTRIES> entries = {};
+        std::size_t count = 0;
+};
+
 class Config {
     public:
         constexpr static FizeauSettings default_settings = {
@@ -60,21 +90,34 @@ class Config {
 
         void (*parse_profile_switch_action)(Config *, FizeauProfileId) = nullptr;
 
+        // When set, apply() adds the profile to this transaction instead of sending it
+        Transaction *transaction = nullptr;
+
+        // When set, open_profile() takes the profiles from this snapshot instead of querying them, and apply() keeps it
+        // up to date. read() and make() fetch it in a single request, and reset it if that fails
+        FizeauState *state = nullptr;
+
     public:
         static int ini_handler(void *user, const char *section, const char *name, const char *value);
         static std::string_view find_config();
 
     public:
-        void read();
+        // Sends the parsed profiles in a single transaction, along with the active flag and profiles if requested
+        Result read(bool with_active_state = false);
         void write();
         std::string make();
 
         Result update();
         Result apply();
+        // Only sends the given fields of the profile (FizeauProfileField)
+        Result apply_fields(std::uint32_t fields);
         Result reset();
         Result open_profile(FizeauProfileId id);
 
     private:
+        // Points state to a fresh snapshot, that of the caller if set, otherwise the given one
+        void fetch_state(FizeauState &snapshot);
+
         void sanitize_profile();
 };
 
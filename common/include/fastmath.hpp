@@ -0,0 +1,195 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <bit>
+#include <limits>
+#include <numbers>
+
+#include "simd.hpp"
+
+namespace fz::fastmath {
+
+// Constant-evaluable replacements for std::log/std::exp/std::pow, used to generate tables at compile time.
+// These are slow, and should not be used at runtime
+constexpr double constexpr_log(double x) {
+    // Reduce to x * 2^e with x in [sqrt(1/2), sqrt(2)), then use log(x) = 2 * atanh((x - 1) / (x + 1))
+    int e = 0;
+    for (; x >= std::numbers::sqrt2;       x /= 2.0, ++e);
+    for (; x <  std::numbers::sqrt2 / 2.0; x *= 2.0, --e);
+
+    double z = (x - 1.0) / (x + 1.0), z2 = z * z, term = z, sum = 0.0;
+    for (int i = 1; i < 40; i += 2, term *= z2)
+        sum += term / i;
+
+    return 2.0 * sum + e * std::numbers::ln2;
+}
+
+constexpr double constexpr_exp(double x) {
+    // Reduce to r + k * log(2) with |r| <= log(2) / 2, then use the Taylor series of exp(r)
+    int k = static_cast<int>(x / std::numbers::ln2 + (x < 0.0 ? -0.5 : 0.5));
+    double r = x - k * std::numbers::ln2, term = 1.0, sum = 1.0;
+    for (int i = 1; i < 24; ++i)
+        term *= r / i, sum += term;
+
+    for (; k > 0; --k, sum *= 2.0);
+    for (; k < 0; ++k, sum /= 2.0);
+    return sum;
+}
+
+constexpr double constexpr_pow(double x, double y) {
+    return (x > 0.0) ? constexpr_exp(y * constexpr_log(x)) : 0.0;
+}
+
+// Precision presets for the exp2/log2 kernels.
+// Exact: relative error of pow() around 1e-10, so the result rounds to the same float as std::pow
+//        in all but pathological cases. This is what keeps the 8-bit LUT2 and 12-bit LUT1 byte-identical
+//        with the reference ramps, as float rounding (and not the output bit depth) then dominates the error.
+// Fast:  relative error of pow() around 1e-7, i.e. under 1e-3 LSB of a 12-bit output, but values
+//        sitting on a rounding boundary may round differently than with std::pow.
+enum class Precision {
+    Fast,
+    Exact,
+};
+
+namespace impl {
+
+// Unrolled at compile time, since the loop form isn't reliably unrolled at -O2/-Os
+template <std::size_t I = 0, typename T, std::size_t N, typename V>
+constexpr V horner(const std::array<T, N> &coeffs, V x) {
+    if constexpr (I == N - 1)
+        return simd::broadcast<V>(coeffs[I]);
+    else
+        return coeffs[I] + x * horner<I + 1>(coeffs, x);
+}
+
+// log2(x) = k + log2(c) + log2(1 + r), where c is the center of one of 16 subintervals of [0.7, 1.4),
+// and |r| = |z/c - 1| < 0.0297
+constexpr std::size_t   log2_table_bits = 4;
+constexpr std::uint32_t log2_table_off  = 0x3f330000;
+
+template <bool Log>
+constexpr auto make_log2_table() {
+    std::array<double, 1 << log2_table_bits> table = {};
+    for (std::uint32_t i = 0; i < table.size(); ++i) {
+        double lo = std::bit_cast<float>(log2_table_off + ( i      << (23 - log2_table_bits))),
+               hi = std::bit_cast<float>(log2_table_off + ((i + 1) << (23 - log2_table_bits)));
+
+        // Use the rounded reciprocal to compute the logarithm, so that the reduction is exact
+        double invc = 2.0 / (lo + hi);
+        table[i] = !Log ? invc : -constexpr_log(invc) / std::numbers::ln2;
+    }
+    return table;
+}
+
+constexpr auto log2_table_invc  = make_log2_table<false>();
+constexpr auto log2_table_log2c = make_log2_table<true>();
+
+// Minimax approximation of log2(1 + r) / r
+template <Precision P>
+constexpr inline auto log2_coeffs = std::array{
+    1.4426950409317609, -0.7213474604329223, 0.48089812773467239, -0.36094084047647018, 0.28891425586658059,
+};
+
+template <>
+constexpr inline auto log2_coeffs<Precision::Fast> = std::array{
+    1.4426949852401203, -0.72158511746880949, 0.48121520613940044,
+};
+
+// 2^x = 2^(k/32) * 2^r, with |r| <= 1/64
+// The table holds the bits of 2^(j/32) minus j << 47, so that adding the raw rounded value of 32 * x
+// shifted by 47 also adds the integer part of x to the exponent
+constexpr std::size_t exp2_table_bits  = 5;
+constexpr double      exp2_round_shift = 0x1.8p52;
+
+constexpr auto exp2_table = [] {
+    std::array<std::uint64_t, 1 << exp2_table_bits> table = {};
+    for (std::uint64_t j = 0; j < table.size(); ++j)
+        table[j] = std::bit_cast<std::uint64_t>(constexpr_exp(std::numbers::ln2 * j / table.size())) -
+            (j << (52 - exp2_table_bits));
+    return table;
+}();
+
+// Minimax approximation of 2^r (relative error)
+template <Precision P>
+constexpr inline auto exp2_coeffs = std::array{
+    0.99999999992834221, 0.69314718066921821, 0.2402288551164001, 0.055503783159793561,
+};
+
+template <>
+constexpr inline auto exp2_coeffs<Precision::Fast> = std::array{
+    1.0000000004299567, 0.69315734356520886, 0.24022474583268985,
+};
+
+} // namespace impl
+
+// The kernels below accept either scalars or simd vectors, and are branchless so that both
+// instantiations perform the exact same operations
+
+// Valid for normal, positive x
+template <Precision P = Precision::Exact, typename F>
+constexpr auto log2(F x) {
+    using U32 = simd::Rebind<std::uint32_t, F>;
+    using I32 = simd::Rebind<std::int32_t,  F>;
+    using D   = simd::Rebind<double,        F>;
+
+    // Split x = z * 2^k with z in [0.7, 1.4), and select the subinterval from the top mantissa bits
+    auto ix  = simd::bit_cast<U32>(x);
+    auto tmp = ix - impl::log2_table_off;
+    auto i   = (tmp >> (23 - impl::log2_table_bits)) % (1u << impl::log2_table_bits);
+    auto k   = simd::bit_cast<I32>(tmp) >> 23;
+    auto z   = simd::bit_cast<F>(ix - (tmp & 0xff800000u));
+
+    auto r = simd::convert<D>(z) * simd::gather(impl::log2_table_invc, i) - 1.0;
+    return r * impl::horner(impl::log2_coeffs<P>, r) + simd::gather(impl::log2_table_log2c, i) + simd::convert<D>(k);
+}
+
+// Saturates to 0 and +inf outside of the single-precision range
+template <Precision P = Precision::Exact, typename D>
+constexpr D exp2(D x) {
+    using U64 = simd::Rebind<std::uint64_t, D>;
+
+    constexpr auto n = static_cast<double>(1 << impl::exp2_table_bits);
+
+    auto in_range = (x >= -160.0) & (x <= 160.0);
+    auto xc = simd::select(in_range, x, 0.0);
+
+    // Round 32 * x to the nearest integer, which ends up in the low bits of kd
+    auto kd = xc * n + impl::exp2_round_shift;
+    auto ki = simd::bit_cast<U64>(kd);
+    kd -= impl::exp2_round_shift;
+
+    auto scale = simd::bit_cast<D>(simd::gather(impl::exp2_table, ki % impl::exp2_table.size()) +
+        (ki << (52 - impl::exp2_table_bits)));
+    auto res = scale * impl::horner(impl::exp2_coeffs<P>, xc - kd / n);
+
+    return simd::select(in_range, res, simd::select(x < 0.0, 0.0, std::numeric_limits<double>::infinity()));
+}
+
+// Valid for x >= 0, y >= 0
+template <Precision P = Precision::Exact, typename F>
+constexpr F pow(F x, float y) {
+    auto res = simd::convert<F>(exp2<P>(static_cast<double>(y) * log2<P>(x)));
+    auto special = simd::select(x == 1.0f, 1.0f, (y == 0.0f) ? 1.0f : 0.0f);
+    return simd::select((x <= 0.0f) | (x == 1.0f), special, res);
+}
+
+} // namespace fz::fastmath
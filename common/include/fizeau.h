@@ -20,6 +20,7 @@
 #ifndef _FZ_IPC_H
 #define _FZ_IPC_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <switch.h>
 
@@ -36,6 +37,18 @@ typedef enum {
     FizeauCommandId_SetProfile,
     FizeauCommandId_GetActiveProfileId,
     FizeauCommandId_SetActiveProfileId,
+    FizeauCommandId_GetWatchdogStats,
+    FizeauCommandId_GetCommitStats,
+    FizeauCommandId_WaitForCommit,
+    FizeauCommandId_GetWakeupStats,
+    FizeauCommandId_ApplyTransaction,
+    FizeauCommandId_SetProfileFields,
+    FizeauCommandId_GetState,
+    FizeauCommandId_SetPreviewSettings,
+    FizeauCommandId_EndPreview,
+    FizeauCommandId_GetPreviewStats,
+    FizeauCommandId_GetStateEvent,
+    FizeauCommandId_GetStateGeneration,
 } FizeauCommandId;
 
 typedef enum {
@@ -48,7 +61,10 @@ typedef enum {
 } FizeauProfileId;
 
 #define FIZEAU_RC_MODULE            R_MODULE(0xf12)
-#define FIZEAU_RC_INVALID_PROFILEID 1
+#define FIZEAU_RC_INVALID_PROFILEID   1
+#define FIZEAU_RC_INVALID_TRANSACTION 2
+#define FIZEAU_RC_INVALID_FIELDS      3
+#define FIZEAU_RC_INVALID_BUFFER      4
 
 #define FIZEAU_MAKERESULT(r) MAKERESULT(FIZEAU_RC_MODULE, FIZEAU_RC_ ## r)
 
@@ -62,6 +78,19 @@ typedef struct {
     ColorRange  range;
 } FizeauSettings;
 
+typedef enum {
+    FizeauTransitionMode_Settings, // Interpolate the settings, and calculate the cmu for each step
+    FizeauTransitionMode_Cmu,      // Interpolate the cmus of both endpoints directly
+} FizeauTransitionMode;
+
+#define FIZEAU_PROFILE_MAX_KEYFRAMES 8
+
+typedef struct {
+    Time time;
+    FizeauSettings settings;
+} FizeauKeyframe;
+
+// Too large to be passed inline with its keyframes, profiles are transferred in buffers
 typedef struct {
     FizeauSettings day_settings, night_settings;
     Component components;
@@ -71,8 +100,155 @@ typedef struct {
     Time dawn_begin, dawn_end;
 
     Time dimming_timeout;
+
+    FizeauTransitionMode transition_mode;
+
+    // Custom schedule, interpolated between consecutive keyframes in the order of their times.
+    // When empty, the day and night settings are held between the dusk and dawn windows
+    uint32_t nb_keyframes;
+    FizeauKeyframe keyframes[FIZEAU_PROFILE_MAX_KEYFRAMES];
 } FizeauProfile;
 
+// Fields of a profile which can be updated individually, as X(name, member)
+#define FIZEAU_PROFILE_FIELDS(X)                        \
+    X(DayTemperature,   day_settings.temperature)       \
+    X(DaySaturation,    day_settings.saturation)        \
+    X(DayHue,           day_settings.hue)               \
+    X(DayContrast,      day_settings.contrast)          \
+    X(DayGamma,         day_settings.gamma)             \
+    X(DayLuminance,     day_settings.luminance)         \
+    X(DayRange,         day_settings.range)             \
+    X(NightTemperature, night_settings.temperature)     \
+    X(NightSaturation,  night_settings.saturation)      \
+    X(NightHue,         night_settings.hue)             \
+    X(NightContrast,    night_settings.contrast)        \
+    X(NightGamma,       night_settings.gamma)           \
+    X(NightLuminance,   night_settings.luminance)       \
+    X(NightRange,       night_settings.range)           \
+    X(Components,       components)                     \
+    X(Filter,           filter)                         \
+    X(DuskBegin,        dusk_begin)                     \
+    X(DuskEnd,          dusk_end)                       \
+    X(DawnBegin,        dawn_begin)                     \
+    X(DawnEnd,          dawn_end)                       \
+    X(DimmingTimeout,   dimming_timeout)                \
+    X(TransitionMode,   transition_mode)                \
+    X(NbKeyframes,      nb_keyframes)                   \
+    X(Keyframes,        keyframes)
+
+typedef enum {
+#define _FZ_FIELD_IDX(name, member) FizeauProfileFieldIdx_##name,
+    FIZEAU_PROFILE_FIELDS(_FZ_FIELD_IDX)
+#undef _FZ_FIELD_IDX
+    FizeauProfileFieldIdx_Total,
+} FizeauProfileFieldIdx;
+
+typedef enum {
+#define _FZ_FIELD_BIT(name, member) FizeauProfileField_##name = BIT(FizeauProfileFieldIdx_##name),
+    FIZEAU_PROFILE_FIELDS(_FZ_FIELD_BIT)
+#undef _FZ_FIELD_BIT
+
+    FizeauProfileField_DaySettings   = FizeauProfileField_DayTemperature   | FizeauProfileField_DaySaturation   |
+        FizeauProfileField_DayHue    | FizeauProfileField_DayContrast      | FizeauProfileField_DayGamma        |
+        FizeauProfileField_DayLuminance | FizeauProfileField_DayRange,
+    FizeauProfileField_NightSettings = FizeauProfileField_NightTemperature | FizeauProfileField_NightSaturation |
+        FizeauProfileField_NightHue  | FizeauProfileField_NightContrast    | FizeauProfileField_NightGamma      |
+        FizeauProfileField_NightLuminance | FizeauProfileField_NightRange,
+    FizeauProfileField_Schedule      = FizeauProfileField_DuskBegin | FizeauProfileField_DuskEnd |
+        FizeauProfileField_DawnBegin | FizeauProfileField_DawnEnd | FizeauProfileField_NbKeyframes | FizeauProfileField_Keyframes,
+    FizeauProfileField_All           = BIT(FizeauProfileFieldIdx_Total) - 1,
+} FizeauProfileField;
+
+typedef struct {
+    uint16_t offset, size;
+} FizeauProfileFieldLayout;
+
+// Location of each field within FizeauProfile, indexed by FizeauProfileFieldIdx
+static const FizeauProfileFieldLayout fizeau_profile_field_layouts[FizeauProfileFieldIdx_Total] = {
+#define _FZ_FIELD_LAYOUT(name, member) { offsetof(FizeauProfile, member), sizeof(((FizeauProfile *)0)->member) },
+    FIZEAU_PROFILE_FIELDS(_FZ_FIELD_LAYOUT)
+#undef _FZ_FIELD_LAYOUT
+};
+
+// Values of the fields in the order of their index, packed. Sent in a buffer, after the id and field mask
+#define FIZEAU_PROFILE_FIELDS_MAX_SIZE sizeof(FizeauProfile)
+
+typedef enum {
+    FizeauTransactionOp_SetIsActive,
+    FizeauTransactionOp_SetActiveProfileId,
+    FizeauTransactionOp_SetProfile,
+} FizeauTransactionOp;
+
+// Same operations as the individual setters
+typedef struct {
+    FizeauTransactionOp op;
+    FizeauProfileId id;            // SetActiveProfileId, SetProfile
+    union {
+        bool is_active;            // SetIsActive
+        bool is_external;          // SetActiveProfileId
+        FizeauProfile profile;     // SetProfile
+    };
+} FizeauTransactionEntry;
+
+// Enough for the whole state: the active flag, both active profiles and every profile
+#define FIZEAU_TRANSACTION_MAX_ENTRIES (1 + 2 + FizeauProfileId_Total)
+
+typedef enum {
+    FizeauPeriod_Day,
+    FizeauPeriod_Dusk,  // Transition from the day to the night settings
+    FizeauPeriod_Night,
+    FizeauPeriod_Dawn,  // Transition from the night to the day settings
+} FizeauPeriod;
+
+// Longest a preview is shown without being renewed
+#define FIZEAU_PREVIEW_MAX_TIMEOUT_MS 10000
+
+// Whole state of the sysmodule, too large to be returned inline
+typedef struct {
+    bool is_active;
+    FizeauProfileId internal_profile, external_profile;
+    FizeauProfile profiles[FizeauProfileId_Total];
+
+    // Of the profile shown on the current display, the factor weighs the night settings against the day ones
+    FizeauPeriod period;
+    float factor;
+
+    // Whether the current display is dimmed
+    bool is_dimmed;
+
+    // Value of the state generation when this was read, see fizeauGetStateEvent
+    uint32_t generation;
+} FizeauState;
+
+typedef struct {
+    uint32_t nb_checks;        // Read-backs of the cmu registers
+    uint32_t nb_resets;        // Resets of the cmu detected by the read-backs
+    uint64_t total_latency_us; // Time between the last successful check and each detection
+    uint64_t max_latency_us;
+} FizeauWatchdogStats;
+
+typedef struct {
+    uint32_t nb_cmu_issued, nb_cmu_skipped;             // Cmu commits, skipped when identical to the previous one
+    uint32_t nb_infoframe_issued, nb_infoframe_skipped; // Same for the rgb quantization range of the hdmi infoframe
+    uint32_t nb_failed;                                 // Failed ioctls, of either kind
+    Result last_error;                                  // Result of the last failed ioctl, 0 if none failed
+} FizeauCommitStats;
+
+typedef struct {
+    uint32_t nb_previews;      // Preview commits
+    uint32_t nb_timeouts;      // Previews reverted by their timeout rather than ended
+    uint64_t last_latency_us;  // Time between the reception of each request and the completion of its commit
+    uint64_t total_latency_us;
+    uint64_t max_latency_us;
+} FizeauPreviewStats;
+
+typedef struct {
+    uint32_t nb_transition_wakeups; // Timer iterations of the profile manager, on deadlines or reschedules
+    uint32_t nb_monitor_wakeups;    // Operation mode and input events handled
+    uint32_t nb_activity_events;    // Input events, only waited on while the screen is dimmed
+    uint32_t nb_activity_queries;   // Queries of the last input tick
+} FizeauWakeupStats;
+
 Result fizeauIsServiceActive(bool *out);
 Result fizeauInitialize();
 void fizeauExit();
@@ -85,9 +261,40 @@ Result fizeauSetIsActive(bool is_active);
 Result fizeauGetProfile(FizeauProfileId id, FizeauProfile *profile);
 Result fizeauSetProfile(FizeauProfileId id, FizeauProfile *profile);
 
+// Only sends the fields of the profile in the mask (FizeauProfileField), the other ones are left untouched
+Result fizeauSetProfileFields(FizeauProfileId id, const FizeauProfile *profile, uint32_t fields);
+
 Result fizeauGetActiveProfileId(bool is_external, FizeauProfileId *id);
 Result fizeauSetActiveProfileId(bool is_external, FizeauProfileId id);
 
+// Everything the getters above return, in a single request
+Result fizeauGetState(FizeauState *state);
+
+// Event signaled when the state changes: activation, active profiles, profile contents, operation mode,
+// period of the current profile or dimming. The transition factor moving within a period does not count.
+// Each session gets its own event, cleared when waited on. Several changes can be signaled at once,
+// so clients should compare the generation to the one of their last read, and refetch the state only when it moved
+Result fizeauGetStateEvent(Event *event);
+Result fizeauGetStateGeneration(uint32_t *generation);
+
+// Applies the entries in order, all of them or none if one is invalid, and commits the result once
+Result fizeauApplyTransaction(const FizeauTransactionEntry *entries, size_t count);
+
+// Commits the settings to the current display right away, without modifying the profiles. Renewing the preview
+// replaces it, and it reverts to the scheduled state after timeout_ms (clamped to FIZEAU_PREVIEW_MAX_TIMEOUT_MS)
+// or when ended. Nothing is previewed while inactive
+Result fizeauSetPreviewSettings(const FizeauSettings *settings, uint32_t timeout_ms);
+Result fizeauEndPreview();
+
+// The setters above return before the new state is committed to the displays.
+// This waits for the pending commits, and returns the result of the last one
+Result fizeauWaitForCommit();
+
+Result fizeauGetWatchdogStats(FizeauWatchdogStats *stats);
+Result fizeauGetCommitStats(FizeauCommitStats *stats);
+Result fizeauGetWakeupStats(FizeauWakeupStats *stats);
+Result fizeauGetPreviewStats(FizeauPreviewStats *stats);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -0,0 +1,172 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <type_traits>
+#include <utility>
+
+namespace fz::simd {
+
+// Thin layer over GCC vector extensions, which get lowered to NEON on aarch64 and SSE/AVX on x86.
+// Vectors wider than the native registers (eg. 4 doubles with NEON) are split by the compiler.
+// All helpers also accept plain scalars, so kernels can be written once and instantiated for both.
+#if defined(__AVX__)
+constexpr inline std::size_t lanes = 8;
+#elif defined(__ARM_NEON) || defined(__SSE2__)
+constexpr inline std::size_t lanes = 4;
+#else
+constexpr inline std::size_t lanes = 1; // Scalar fallback
+#endif
+
+namespace impl {
+
+template <typename T, std::size_t N>
+struct VecType {
+    using type [[gnu::vector_size(sizeof(T) * N)]] = T;
+};
+
+template <typename T>
+struct VecType<T, 1> {
+    using type = T;
+};
+
+template <typename T>
+struct Traits {
+    using Elem = T;
+    constexpr static std::size_t Lanes = 1;
+};
+
+template <typename T> requires requires (T v) { { v[0] } -> std::convertible_to<double>; } && (!std::is_pointer_v<T>)
+struct Traits<T> {
+    using Elem = std::remove_cvref_t<decltype(std::declval<T>()[0])>;
+    constexpr static std::size_t Lanes = sizeof(T) / sizeof(Elem);
+};
+
+} // namespace impl
+
+template <typename T, std::size_t N = lanes>
+using Vec = typename impl::VecType<T, N>::type;
+
+template <typename V>
+constexpr inline std::size_t lanes_of = impl::Traits<V>::Lanes;
+
+template <typename V>
+constexpr inline bool is_vector = lanes_of<V> > 1;
+
+// Vector of T with the same number of lanes as V
+template <typename T, typename V>
+using Rebind = Vec<T, lanes_of<V>>;
+
+template <typename V>
+constexpr V broadcast(typename impl::Traits<V>::Elem x) {
+    if constexpr (is_vector<V>)
+        return V{} + x;
+    else
+        return x;
+}
+
+// Lane-wise value conversion (truncating for float to integer)
+template <typename To, typename From>
+constexpr To convert(From v) {
+    if constexpr (is_vector<From>)
+        return __builtin_convertvector(v, To);
+    else
+        return static_cast<To>(v);
+}
+
+template <typename To, typename From>
+constexpr To bit_cast(From v) {
+    return std::bit_cast<To>(v);
+}
+
+// Mask is the result of a comparison (bool for scalars, integer vector otherwise).
+// Scalar operands are broadcast when the other one or the mask is a vector
+template <typename M, typename A, typename B>
+constexpr auto select(M mask, A a, B b) {
+    if constexpr (is_vector<A> && !is_vector<B>)
+        return mask ? a : broadcast<A>(b);
+    else if constexpr (!is_vector<A> && is_vector<B>)
+        return mask ? broadcast<B>(a) : b;
+    else
+        return mask ? a : b;
+}
+
+// Same semantics as std::clamp, including the handling of signed zeroes
+template <typename V, typename T>
+constexpr V clamp(V v, T lo, T hi) {
+    return select(v < lo, lo, select(hi < v, hi, v));
+}
+
+template <typename V, typename T>
+constexpr V max(V v, T lo) {
+    return select(v < lo, lo, v);
+}
+
+// Same semantics as std::round (half away from zero), for |v| < 2^31
+template <typename V>
+constexpr V round(V v) {
+    if constexpr (is_vector<V>) {
+        auto t = convert<V>(convert<Rebind<std::int32_t, V>>(v));
+        auto d = v - t;
+        return select(d >= 0.5f, t + 1.0f, select(d <= -0.5f, t - 1.0f, t));
+    } else {
+        return std::round(v);
+    }
+}
+
+// Unaligned load/store of the lanes of V from/to contiguous elements
+template <typename V, typename T>
+constexpr V load(const T *array, std::size_t idx) {
+    if constexpr (is_vector<V>) {
+        V res = {};
+        for (std::size_t i = 0; i < lanes_of<V>; ++i)
+            res[i] = array[idx + i];
+        return res;
+    } else {
+        return static_cast<V>(array[idx]);
+    }
+}
+
+template <typename T, typename V>
+constexpr void store(T *array, std::size_t idx, V v) {
+    if constexpr (is_vector<V>) {
+        for (std::size_t i = 0; i < lanes_of<V>; ++i)
+            array[idx + i] = static_cast<T>(v[i]);
+    } else {
+        array[idx] = static_cast<T>(v);
+    }
+}
+
+template <typename T, std::size_t S, typename I>
+constexpr Rebind<T, I> gather(const std::array<T, S> &table, I idx) {
+    if constexpr (is_vector<I>) {
+        Rebind<T, I> res = {};
+        for (std::size_t i = 0; i < lanes_of<I>; ++i)
+            res[i] = table[idx[i]];
+        return res;
+    } else {
+        return table[idx];
+    }
+}
+
+} // namespace fz::simd
@@ -54,6 +54,11 @@ exit:
             return (Clock::timestamp + armTicksToNs(armGetSystemTick() - Clock::tick) / 1'000'000'000) % (24*60*60);
         }
 
+        // Nanoseconds elapsed since the start of the current second
+        static std::uint64_t get_current_second_offset() {
+            return armTicksToNs(armGetSystemTick() - Clock::tick) % 1'000'000'000;
+        }
+
         static Time get_current_time() {
             return from_timestamp(Clock::get_current_timestamp());
         }
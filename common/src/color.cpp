@@ -25,6 +25,54 @@
 
 namespace fz {
 
+namespace {
+
+constexpr double ce_degamma(double x, double gamma) {
+    if (x <= 0.040045)
+        return x * 24.972 * fastmath::constexpr_pow(0.090, gamma);
+    return fastmath::constexpr_pow((x + 0.055) / (1.0 + 0.055), gamma);
+}
+
+// Linear (degamma'd) whitepoint, sampled every 100°K and stored in Q1.14.
+// The formula is discontinuous at 6600°K, so each side is tabulated separately,
+// and values are stored unclamped so that clamping after interpolation keeps the knees exact.
+constexpr Temperature wp_table_step = 100, wp_table_knee = 6600;
+constexpr std::size_t wp_table_frac_bits = 14;
+
+using WhitepointEntry = std::array<std::int16_t, 3>;
+
+template <bool Upper>
+constexpr auto make_whitepoint_table() {
+    constexpr Temperature lo = !Upper ? MIN_TEMP : wp_table_knee, hi = !Upper ? wp_table_knee : MAX_TEMP;
+
+    std::array<WhitepointEntry, (hi - lo) / wp_table_step + 1> table = {};
+    for (std::size_t i = 0; i < table.size(); ++i) {
+        double temp = static_cast<double>(lo + i * wp_table_step) / 100.0, rgb[3];
+
+        if (!Upper) {
+            rgb[0] = 255.0;
+            rgb[1] = 99.4708025861 * fastmath::constexpr_log(temp) - 161.1195681661;
+            rgb[2] = (temp <= 19.0) ? 0.0 : 138.5177312231 * fastmath::constexpr_log(temp - 10.0) - 305.0447927307;
+        } else {
+            rgb[0] = 329.698727446 * fastmath::constexpr_pow(temp - 60.0, -0.1332047592);
+            rgb[1] = 288.1221695283 * fastmath::constexpr_pow(temp - 60.0, -0.0755148492);
+            rgb[2] = 255.0;
+        }
+
+        for (std::size_t j = 0; j < 3; ++j) {
+            auto v = ce_degamma(rgb[j] / 255.0, DEFAULT_GAMMA) * (1 << wp_table_frac_bits);
+            table[i][j] = static_cast<std::int16_t>(v + (v < 0.0 ? -0.5 : 0.5));
+        }
+    }
+
+    return table;
+}
+
+constexpr auto wp_table_lo = make_whitepoint_table<false>();
+constexpr auto wp_table_hi = make_whitepoint_table<true>();
+
+} // namespace
+
 ColorMatrix filter_matrix(Component filter) {
     ColorMatrix arr = {};
 
@@ -81,6 +129,35 @@ std::tuple<float, float, float> whitepoint(Temperature temperature) {
     };
 }
 
+std::tuple<float, float, float> whitepoint_linear(Temperature temperature) {
+    if (temperature == D65_TEMP)
+        return { 1.0f, 1.0f, 1.0f }; // Fast path
+
+    auto to_float = [](std::int32_t v) {
+        return std::clamp(static_cast<float>(v) / (1 << wp_table_frac_bits), 0.0f, 1.0f);
+    };
+
+    temperature = std::clamp(temperature, MIN_TEMP, MAX_TEMP);
+
+    // Red and green use the lower branch at the knee, blue the upper one
+    if (temperature == wp_table_knee)
+        return { to_float(wp_table_lo.back()[0]), to_float(wp_table_lo.back()[1]), to_float(wp_table_hi.front()[2]) };
+
+    auto lookup = [&](const auto &table, Temperature base) -> std::tuple<float, float, float> {
+        auto idx  = std::min<std::size_t>((temperature - base) / wp_table_step, table.size() - 2);
+        auto frac = static_cast<std::int32_t>(temperature - base - idx * wp_table_step);
+
+        auto lerp = [&](std::size_t c) {
+            std::int32_t a = table[idx][c], b = table[idx + 1][c];
+            return to_float(a + (b - a) * frac / static_cast<std::int32_t>(wp_table_step));
+        };
+
+        return { lerp(0), lerp(1), lerp(2) };
+    };
+
+    return (temperature < wp_table_knee) ? lookup(wp_table_lo, MIN_TEMP) : lookup(wp_table_hi, wp_table_knee);
+}
+
 ColorMatrix hue_matrix(Hue hue) {
     if (hue == DEFAULT_HUE) // Fast path
         return { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
@@ -126,11 +203,7 @@ float regamma(float x, Gamma gamma) {
 }
 
 void gamma_ramp(float (*func)(float, Gamma), std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits, float lo, float hi, float off) {
-    float step = (hi - lo) / (size - 1), cur = lo;
-    std::uint16_t shift = (1 << nb_bits) - 1, mask = (1 << (nb_bits + 1)) - 1;
-
-    for (std::size_t i = 0; i < size; ++i, cur += step)
-        array[i] = static_cast<std::uint16_t>(std::round(func(std::clamp(cur + off, 0.0f, 1.0f), gamma) * shift)) & mask;
+    impl::ramp([func, gamma](float x) { return func(x, gamma); }, array, size, nb_bits, lo, hi, off);
 }
 
 void apply_luma(std::uint16_t *array, std::size_t size, std::size_t nb_bits, Luminance luma) {
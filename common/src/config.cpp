@@ -18,6 +18,7 @@
 #include <cstring>
 #include <algorithm>
 #include <bit>
+#include <span>
 #include <string>
 #include <ini.h>
 #include <common.hpp>
@@ -39,12 +40,64 @@ std::string_view Config::find_config() {
     return config_locations[1];
 };
 
-void Config::read() {
+void Transaction::set_is_active(bool is_active) {
+    this->find_entry(FizeauTransactionOp_SetIsActive, FizeauProfileId_Invalid, false).is_active = is_active;
+}
+
+void Transaction::set_active_profile_id(bool is_external, FizeauProfileId id) {
+    auto &entry = this->find_entry(FizeauTransactionOp_SetActiveProfileId, FizeauProfileId_Invalid, is_external);
+    entry.id = id, entry.is_external = is_external;
+}
+
+void Transaction::set_profile(FizeauProfileId id, const FizeauProfile &profile) {
+    this->find_entry(FizeauTransactionOp_SetProfile, id, false).profile = profile;
+}
+
+FizeauTransactionEntry &Transaction::find_entry(FizeauTransactionOp op, FizeauProfileId id, bool is_external) {
+    auto first = this->entries.begin(), last = this->entries.begin() + this->count;
+    auto it = std::find_if(first, last, [&](const FizeauTransactionEntry &entry) {
+        switch (op) {
+            case FizeauTransactionOp_SetActiveProfileId:
+                return (entry.op == op) && (entry.is_external == is_external);
+            case FizeauTransactionOp_SetProfile:
+                return (entry.op == op) && (entry.id == id);
+            default:
+                return entry.op == op;
+        }
+    });
+
+    // Each target has a single entry, so the array can't overflow
+    if (it == last) {
+        *it = { .op = op, .id = id };
+        ++this->count;
+    }
+
+    return *it;
+}
+
+Result Transaction::apply() {
+    if (this->is_empty())
+        return 0;
+
+    auto rc = fizeauApplyTransaction(this->entries.data(), this->count);
+    this->count = 0;
+    return rc;
+}
+
+Result Config::read(bool with_active_state) {
+    Transaction transaction;
+    this->transaction = &transaction;
+    FZ_SCOPEGUARD([this] { this->transaction = nullptr; });
+
+    // Profiles are opened from a single snapshot, instead of one request each
+    FizeauState snapshot;
+    this->fetch_state(snapshot);
+    FZ_SCOPEGUARD([&] { if (this->state == &snapshot) this->state = nullptr; });
+
     if (!this->parse_profile_switch_action) {
         this->parse_profile_switch_action = +[](Config *self, FizeauProfileId profile_id) {
             if (self->cur_profile_id != FizeauProfileId_Invalid)
-                if (auto rc = self->apply(); R_FAILED(rc))
-                    LOG("Failed to apply config: %#x\n", rc);
+                self->apply();
             if (auto rc = self->open_profile(profile_id); R_FAILED(rc))
                 LOG("Failed to open profile: %#x\n", rc);
         };
@@ -53,10 +106,26 @@ void Config::read() {
     auto loc = Config::find_config();
     ini_parse(loc.data(), Config::ini_handler, this);
 
-    if (this->cur_profile_id != FizeauProfileId_Invalid) {
-        if (auto rc = this->apply(); R_FAILED(rc))
-            LOG("Failed to apply config: %#x\n", rc);
+    if (this->cur_profile_id != FizeauProfileId_Invalid)
+        this->apply();
+
+    if (with_active_state) {
+        transaction.set_is_active(this->active);
+        transaction.set_active_profile_id(false, this->internal_profile);
+        transaction.set_active_profile_id(true,  this->external_profile);
+
+        if (this->state) {
+            this->state->is_active        = this->active;
+            this->state->internal_profile = this->internal_profile;
+            this->state->external_profile = this->external_profile;
+        }
     }
+
+    auto rc = transaction.apply();
+    if (R_FAILED(rc))
+        LOG("Failed to apply config: %#x\n", rc);
+
+    return rc;
 }
 
 void Config::sanitize_profile() {
@@ -107,6 +176,20 @@ void Config::sanitize_profile() {
 
     sanitize_colorrange(this->profile.day_settings  .range);
     sanitize_colorrange(this->profile.night_settings.range);
+
+    sanitize_minmax(this->profile.transition_mode, FizeauTransitionMode_Settings, FizeauTransitionMode_Cmu);
+
+    sanitize_minmax(this->profile.nb_keyframes, 0, FIZEAU_PROFILE_MAX_KEYFRAMES);
+    for (auto &keyframe: std::span(this->profile.keyframes, this->profile.nb_keyframes)) {
+        sanitize_time(keyframe.time);
+        sanitize_minmax(keyframe.settings.temperature, MIN_TEMP,     MAX_TEMP);
+        sanitize_minmax(keyframe.settings.saturation,  MIN_SAT,      MAX_SAT);
+        sanitize_minmax(keyframe.settings.hue,         MIN_HUE,      MAX_HUE);
+        sanitize_minmax(keyframe.settings.contrast,    MIN_CONTRAST, MAX_CONTRAST);
+        sanitize_minmax(keyframe.settings.gamma,       MIN_GAMMA,    MAX_GAMMA);
+        sanitize_minmax(keyframe.settings.luminance,   MIN_LUMA,     MAX_LUMA);
+        sanitize_colorrange(keyframe.settings.range);
+    }
 }
 
 std::string Config::make() {
@@ -143,6 +226,13 @@ std::string Config::make() {
         }
     };
 
+    auto format_transition_mode = [](FizeauTransitionMode m) -> std::string {
+        switch (m) {
+            case FizeauTransitionMode_Cmu: return "cmu";
+            default:                       return "settings";
+        }
+    };
+
     auto format_time = [&format](Time t) -> std::string {
         return format("%02d:%02d", t.h, t.m);
     };
@@ -167,6 +257,10 @@ std::string Config::make() {
         str += "docked_profile    = " + format_profile(FizeauProfileId_Profile2) + '\n';
     str += '\n';
 
+    FizeauState snapshot;
+    this->fetch_state(snapshot);
+    FZ_SCOPEGUARD([&] { if (this->state == &snapshot) this->state = nullptr; });
+
     for (int id = FizeauProfileId_Profile1; id < FizeauProfileId_Total; ++id) {
         if (auto rc = this->open_profile(static_cast<FizeauProfileId>(id)); R_FAILED(rc))
             LOG("Failed to open profile %u: %#x\n", id, rc);
@@ -207,6 +301,23 @@ std::string Config::make() {
 
         str += "dimming_timeout   = " + format_time({ this->profile.dimming_timeout.m, this->profile.dimming_timeout.s }) + '\n';
 
+        str += "transition_mode   = " + format_transition_mode(this->profile.transition_mode)    + '\n';
+
+        str += "keyframes         = " + std::to_string(this->profile.nb_keyframes)               + '\n';
+        for (std::uint32_t i = 0; i < this->profile.nb_keyframes; ++i) {
+            auto &keyframe = this->profile.keyframes[i];
+            auto key = [&format, i](const char *setting) { return format("keyframe%u_%-12s= ", i + 1, setting); };
+
+            str += key("time")        + format_time(keyframe.time)                               + '\n';
+            str += key("temperature") + std::to_string(keyframe.settings.temperature)            + '\n';
+            str += key("saturation")  + std::to_string(keyframe.settings.saturation)             + '\n';
+            str += key("hue")         + std::to_string(keyframe.settings.hue)                    + '\n';
+            str += key("contrast")    + std::to_string(keyframe.settings.contrast)               + '\n';
+            str += key("gamma")       + std::to_string(keyframe.settings.gamma)                  + '\n';
+            str += key("luminance")   + std::to_string(keyframe.settings.luminance)              + '\n';
+            str += key("range")       + format_range(keyframe.settings.range)                    + '\n';
+        }
+
         str += '\n';
     }
 
@@ -241,10 +352,41 @@ Result update(Config &config) {
     return 0;
 }
 
+void Config::fetch_state(FizeauState &snapshot) {
+    // Into the snapshot of the caller if there is one
+    auto *state = this->state ? this->state : &snapshot;
+    if (auto rc = fizeauGetState(state); R_FAILED(rc)) {
+        LOG("Failed to get state: %#x\n", rc);
+        this->state = nullptr;
+        return;
+    }
+
+    this->state = state;
+}
+
 Result Config::apply() {
+    if (this->state && (this->cur_profile_id < FizeauProfileId_Total))
+        this->state->profiles[this->cur_profile_id] = this->profile;
+
+    if (this->transaction) {
+        this->transaction->set_profile(this->cur_profile_id, this->profile);
+        return 0;
+    }
+
     return fizeauSetProfile(this->cur_profile_id, &this->profile);
 }
 
+Result Config::apply_fields(std::uint32_t fields) {
+    // Transactions carry whole profiles
+    if (this->transaction)
+        return this->apply();
+
+    if (this->state && (this->cur_profile_id < FizeauProfileId_Total))
+        this->state->profiles[this->cur_profile_id] = this->profile;
+
+    return fizeauSetProfileFields(this->cur_profile_id, &this->profile, fields);
+}
+
 Result Config::reset() {
     this->profile.day_settings.temperature = DEFAULT_TEMP,     this->profile.night_settings.temperature = DEFAULT_TEMP;
     this->profile.day_settings.saturation  = DEFAULT_SAT,      this->profile.night_settings.saturation  = DEFAULT_SAT;
@@ -255,12 +397,20 @@ Result Config::reset() {
     this->profile.day_settings.range       = DEFAULT_RANGE,    this->profile.night_settings.range       = DEFAULT_RANGE;
     this->profile.components = Component_All;
     this->profile.filter     = Component_None;
-    return this->apply();
+    for (auto &keyframe: this->profile.keyframes)
+        keyframe.settings = Config::default_settings;
+    return this->apply_fields(FizeauProfileField_DaySettings | FizeauProfileField_NightSettings | FizeauProfileField_Keyframes |
+        FizeauProfileField_Components | FizeauProfileField_Filter);
 }
 
 Result Config::open_profile(FizeauProfileId id) {
-    if (auto rc = fizeauGetProfile(id, &this->profile); R_FAILED(rc))
+    if (this->state) {
+        if (id >= FizeauProfileId_Total)
+            return FIZEAU_MAKERESULT(INVALID_PROFILEID);
+        this->profile = this->state->profiles[id];
+    } else if (auto rc = fizeauGetProfile(id, &this->profile); R_FAILED(rc)) {
         return rc;
+    }
 
     this->cur_profile_id = id;
     return 0;
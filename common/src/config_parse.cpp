@@ -1,6 +1,7 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdint>
+#include <algorithm>
 
 #include "config.hpp"
 
@@ -127,6 +128,12 @@ int Config::ini_handler(void *user, const char *section, const char *name, const
 
     static_assert(parse_range("0.18-0.92") == ColorRange{0.18, 0.92});
 
+    auto parse_transition_mode = [](const std::string_view &str) -> FizeauTransitionMode {
+        if (strcasecmp(str.data(), "cmu") == 0)
+            return FizeauTransitionMode_Cmu;
+        return FizeauTransitionMode_Settings;
+    };
+
     if (MATCH_ENTRY("", "active")) {
         if (MATCH(value, "1") || strcasecmp(value, "true") == 0)
             config->active = true;
@@ -195,6 +202,38 @@ int Config::ini_handler(void *user, const char *section, const char *name, const
         } else if (MATCH(name, "dimming_timeout")) {
             auto t = parse_time(v);
             config->profile.dimming_timeout = { 0, t.h, t.m };
+        } else if (MATCH(name, "transition_mode")) {
+            config->profile.transition_mode = parse_transition_mode(v);
+        } else if (MATCH(name, "keyframes")) {
+            p.nb_keyframes = std::clamp(atoi(v), 0, FIZEAU_PROFILE_MAX_KEYFRAMES);
+        } else if (std::string_view key = name; key.starts_with("keyframe")) {
+            // keyframe<n>_<setting>, numbered from 1. Keyframes past the count extend it, starting from the defaults
+            auto pos = key.find('_');
+            auto idx = atoi(substr(key, 8, pos - 8)) - 1;
+            if ((pos == std::string_view::npos) || (idx < 0) || (idx >= FIZEAU_PROFILE_MAX_KEYFRAMES))
+                return 1;
+
+            while (p.nb_keyframes <= static_cast<std::uint32_t>(idx))
+                p.keyframes[p.nb_keyframes++] = { {}, Config::default_settings };
+
+            auto &k = p.keyframes[idx];
+            auto setting = substr(key, pos + 1);
+            if (setting == "time")
+                k.time = parse_time(v);
+            else if (setting == "temperature")
+                k.settings.temperature = atoi(v);
+            else if (setting == "saturation")
+                k.settings.saturation = atof(v);
+            else if (setting == "hue")
+                k.settings.hue = atof(v);
+            else if (setting == "contrast")
+                k.settings.contrast = atof(v);
+            else if (setting == "gamma")
+                k.settings.gamma = atof(v);
+            else if (setting == "luminance")
+                k.settings.luminance = atof(v);
+            else if (setting == "range")
+                k.settings.range = parse_range(v);
         }
     } else {
         return 0;
@@ -17,6 +17,7 @@
  * along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <switch.h>
 
 #define NX_SERVICE_ASSUME_NON_DOMAIN
@@ -65,21 +66,41 @@ Result fizeauSetIsActive(bool is_active) {
 }
 
 Result fizeauGetProfile(FizeauProfileId id, FizeauProfile *profile) {
-    FizeauProfile tmp;
-    Result rc = serviceDispatchInOut(&g_fizeau_srv, FizeauCommandId_GetProfile, id, tmp);
-
-    if (R_SUCCEEDED(rc) && profile)
-        *profile = tmp;
-
-    return rc;
+    return serviceDispatchIn(&g_fizeau_srv, FizeauCommandId_GetProfile, id,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
+        .buffers      = { { profile, sizeof(*profile) } },
+    );
 }
 
 Result fizeauSetProfile(FizeauProfileId id, FizeauProfile *profile) {
+    return serviceDispatchIn(&g_fizeau_srv, FizeauCommandId_SetProfile, id,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In },
+        .buffers      = { { profile, sizeof(*profile) } },
+    );
+}
+
+Result fizeauSetProfileFields(FizeauProfileId id, const FizeauProfile *profile, uint32_t fields) {
     struct {
         FizeauProfileId id;
-        FizeauProfile profile;
-    } tmp = { id, *profile };
-    return serviceDispatchIn(&g_fizeau_srv, FizeauCommandId_SetProfile, tmp);
+        uint32_t fields;
+    } in = { id, fields };
+
+    u8 tmp[FIZEAU_PROFILE_FIELDS_MAX_SIZE];
+    size_t size = 0;
+
+    for (int i = 0; i < FizeauProfileFieldIdx_Total; ++i) {
+        if (!(fields & BIT(i)))
+            continue;
+
+        const FizeauProfileFieldLayout *layout = &fizeau_profile_field_layouts[i];
+        memcpy(tmp + size, (const u8 *)profile + layout->offset, layout->size);
+        size += layout->size;
+    }
+
+    return serviceDispatchIn(&g_fizeau_srv, FizeauCommandId_SetProfileFields, in,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In },
+        .buffers      = { { tmp, size } },
+    );
 }
 
 Result fizeauGetActiveProfileId(bool is_external, FizeauProfileId *id) {
@@ -99,3 +120,96 @@ Result fizeauSetActiveProfileId(bool is_external, FizeauProfileId id) {
     } tmp = { is_external, id };
     return serviceDispatchIn(&g_fizeau_srv, FizeauCommandId_SetActiveProfileId, tmp);
 }
+
+Result fizeauGetState(FizeauState *state) {
+    return serviceDispatch(&g_fizeau_srv, FizeauCommandId_GetState,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
+        .buffers      = { { state, sizeof(*state) } },
+    );
+}
+
+Result fizeauGetStateEvent(Event *event) {
+    Handle handle;
+    Result rc = serviceDispatch(&g_fizeau_srv, FizeauCommandId_GetStateEvent,
+        .out_handle_attrs = { SfOutHandleAttr_HipcCopy },
+        .out_handles      = &handle,
+    );
+
+    if (R_SUCCEEDED(rc))
+        eventLoadRemote(event, handle, true);
+
+    return rc;
+}
+
+Result fizeauGetStateGeneration(uint32_t *generation) {
+    uint32_t tmp;
+    Result rc = serviceDispatchOut(&g_fizeau_srv, FizeauCommandId_GetStateGeneration, tmp);
+
+    if (R_SUCCEEDED(rc) && generation)
+        *generation = tmp;
+
+    return rc;
+}
+
+Result fizeauApplyTransaction(const FizeauTransactionEntry *entries, size_t count) {
+    return serviceDispatch(&g_fizeau_srv, FizeauCommandId_ApplyTransaction,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In },
+        .buffers      = { { entries, count * sizeof(*entries) } },
+    );
+}
+
+Result fizeauSetPreviewSettings(const FizeauSettings *settings, uint32_t timeout_ms) {
+    struct {
+        FizeauSettings settings;
+        uint32_t timeout_ms;
+    } tmp = { *settings, timeout_ms };
+    return serviceDispatchIn(&g_fizeau_srv, FizeauCommandId_SetPreviewSettings, tmp);
+}
+
+Result fizeauEndPreview(void) {
+    return serviceDispatch(&g_fizeau_srv, FizeauCommandId_EndPreview);
+}
+
+Result fizeauWaitForCommit(void) {
+    return serviceDispatch(&g_fizeau_srv, FizeauCommandId_WaitForCommit);
+}
+
+Result fizeauGetWatchdogStats(FizeauWatchdogStats *stats) {
+    FizeauWatchdogStats tmp;
+    Result rc = serviceDispatchOut(&g_fizeau_srv, FizeauCommandId_GetWatchdogStats, tmp);
+
+    if (R_SUCCEEDED(rc) && stats)
+        *stats = tmp;
+
+    return rc;
+}
+
+Result fizeauGetCommitStats(FizeauCommitStats *stats) {
+    FizeauCommitStats tmp;
+    Result rc = serviceDispatchOut(&g_fizeau_srv, FizeauCommandId_GetCommitStats, tmp);
+
+    if (R_SUCCEEDED(rc) && stats)
+        *stats = tmp;
+
+    return rc;
+}
+
+Result fizeauGetWakeupStats(FizeauWakeupStats *stats) {
+    FizeauWakeupStats tmp;
+    Result rc = serviceDispatchOut(&g_fizeau_srv, FizeauCommandId_GetWakeupStats, tmp);
+
+    if (R_SUCCEEDED(rc) && stats)
+        *stats = tmp;
+
+    return rc;
+}
+
+Result fizeauGetPreviewStats(FizeauPreviewStats *stats) {
+    FizeauPreviewStats tmp;
+    Result rc = serviceDispatchOut(&g_fizeau_srv, FizeauCommandId_GetPreviewStats, tmp);
+
+    if (R_SUCCEEDED(rc) && stats)
+        *stats = tmp;
+
+    return rc;
+}
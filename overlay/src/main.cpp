@@ -19,6 +19,7 @@
 #define STBTT_STATIC
 #define TESLA_INIT_IMPL
 
+#include <atomic>
 #include <exception_wrap.hpp>
 #include <tesla.hpp>
 #include <common.hpp>
@@ -146,6 +147,12 @@ static constexpr Time OVERRIDE_NIGHT_DUSK_END   = {0, 0, 0};
 static constexpr Time OVERRIDE_NIGHT_DAWN_BEGIN = {0, 0, 0};
 static constexpr Time OVERRIDE_NIGHT_DAWN_END   = {0, 0, 0};
 
+// Settings sliders are previewed while they move, and only stored once they
+// have been left alone for PREVIEW_SETTLE_FRAMES.  The sysmodule reverts the
+// preview by itself after PREVIEW_TIMEOUT_MS if it never gets stored.
+static constexpr std::uint32_t PREVIEW_TIMEOUT_MS    = 1000;
+static constexpr int           PREVIEW_SETTLE_FRAMES = 30;
+
 struct ProfilePeriodState {
     PeriodOverride override = PeriodOverride::Dynamic;
     // Original dusk/dawn times saved when the user enables Day or Night.
@@ -266,7 +273,25 @@ public:
         if (R_FAILED(rc))
             return;
 
+        // Taken before the snapshot, so that no change after it goes unnoticed.
+        // Waited on by a thread, which flags the changes for the next frame
+        this->has_state_event = R_SUCCEEDED(fizeauGetStateEvent(&this->state_event));
+        if (this->has_state_event) {
+            ueventCreate(&this->exit_event, false);
+            this->has_state_event = R_SUCCEEDED(threadCreate(&this->state_thread, &FizeauOverlayGui::wait_for_state_changes,
+                this, nullptr, 0x1000, 0x2c, -2)) && R_SUCCEEDED(threadStart(&this->state_thread));
+            if (!this->has_state_event)
+                eventClose(&this->state_event);
+        }
+
+        // Everything below is read from a single snapshot of the sysmodule state,
+        // fetched by read() and kept up to date with what we send
+        FizeauState state = {};
+        this->config.state = &state;
+        FZ_SCOPEGUARD([this] { this->config.state = nullptr; });
+
         this->config.read();
+        this->state_generation = state.generation;
 
         // Ensure config.ini always has all 4 profile sections.
         // Appends defaults for any missing ones (ini + sysmodule).
@@ -287,7 +312,9 @@ public:
             this->config.external_profile = FizeauProfileId_Profile1;
 
         // Read the actual active state from the system
-        if (this->rc = fizeauGetIsActive(&this->config.active); R_FAILED(this->rc))
+        if (this->config.state)
+            this->config.active = this->config.state->is_active;
+        else if (this->rc = fizeauGetIsActive(&this->config.active); R_FAILED(this->rc))
             return;
 
         if (this->rc = apmGetPerformanceMode(&this->perf_mode); R_FAILED(this->rc))
@@ -329,8 +356,8 @@ public:
     virtual ~FizeauOverlayGui() {
         // Flush any pending slider changes so the sysmodule has the latest data
         // before we read all profiles back in config.write().
-        if (this->pending_apply) {
-            this->config.apply();
+        if (this->pending_apply || this->is_previewing) {
+            this->apply_with_override();
         }
 
         // Persist the override states and real times to disk.
@@ -347,6 +374,13 @@ public:
         // profiles.
         this->config.write();
 
+        if (this->has_state_event) {
+            ueventSignal(&this->exit_event);
+            threadWaitForExit(&this->state_thread);
+            threadClose(&this->state_thread);
+            eventClose(&this->state_event);
+        }
+
         fizeauExit();
     }
 
@@ -367,6 +401,28 @@ public:
         return Clock::is_in_interval(this->config.profile.dawn_end, this->config.profile.dusk_begin);
     }
 
+    // Called when the state event is signaled. Rereads the display mode and is_day,
+    // unless the signal was left over from a change we already saw.
+    static void wait_for_state_changes(void *arg) {
+        auto *self = static_cast<FizeauOverlayGui *>(arg);
+
+        // The state event clears itself when waited on
+        s32 idx;
+        while (R_SUCCEEDED(waitMulti(&idx, UINT64_MAX, waiterForEvent(&self->state_event), waiterForUEvent(&self->exit_event))) &&
+                (idx == 0))
+            self->is_state_changed.store(true, std::memory_order_release);
+    }
+
+    void refresh_state() {
+        std::uint32_t generation;
+        if (R_FAILED(fizeauGetStateGeneration(&generation)) || (generation == this->state_generation))
+            return;
+
+        this->state_generation = generation;
+        apmGetPerformanceMode(&this->perf_mode);
+        this->is_day = this->compute_is_day();
+    }
+
     // Refresh all slider/button positions from current profile & is_day state.
     void refresh_sliders() {
         this->is_day = this->compute_is_day();
@@ -479,7 +535,7 @@ public:
         }
 
         // ── Push defaults to sysmodule for the current session ───────────────
-        // Build a profile that matches exactly what we just wrote to disk.
+        // Build a profile that matches exactly what we just wrote to disk, sent in one transaction.
         FizeauProfile def = {};
         def.day_settings   = Config::default_settings;
         def.night_settings = Config::default_settings;
@@ -491,8 +547,13 @@ public:
         def.filter         = Component_None;
         def.dimming_timeout = {};
 
-        for (std::size_t i = existing; i < FizeauProfileId_Total; ++i)
-            fizeauSetProfile(static_cast<FizeauProfileId>(i), &def);
+        Transaction transaction;
+        for (std::size_t i = existing; i < FizeauProfileId_Total; ++i) {
+            transaction.set_profile(static_cast<FizeauProfileId>(i), def);
+            if (this->config.state)
+                this->config.state->profiles[i] = def;
+        }
+        transaction.apply();
     }
 
     // Count contiguous [profileN] sections starting at N=1 in config.ini.
@@ -634,27 +695,56 @@ public:
                 break;
         }
 
-        // Push the updated profile (with patched or restored times) to the
-        // sysmodule so it takes effect immediately.
-        this->config.apply();
+        // Push the patched or restored times to the sysmodule so they take
+        // effect immediately.
+        this->apply_with_override(FizeauProfileField_Schedule);
     }
 
-    // Thin wrapper kept for call-site clarity.  With the time-patching approach
-    // there is no longer any settings mirroring to do — just push the profile.
-    Result apply_with_override() {
-        return this->config.apply();
+    // Pushes the given fields along with those changed by the sliders since
+    // the last push.  With the time-patching approach there is no settings
+    // mirroring to do, so only the modified fields are sent.
+    Result apply_with_override(std::uint32_t fields = 0) {
+        auto rc = this->config.apply_fields(fields | std::exchange(this->pending_fields, 0));
+
+        // The stored profile now shows what was previewed
+        if (std::exchange(this->is_previewing, false))
+            fizeauEndPreview();
+
+        return rc;
+    }
+
+    // Shows the settings being edited on the current display, without storing them
+    Result preview_settings() {
+        auto &settings = this->is_day ? this->config.profile.day_settings : this->config.profile.night_settings;
+        this->is_previewing = true;
+        this->settle_counter = 0;
+        return fizeauSetPreviewSettings(&settings, PREVIEW_TIMEOUT_MS);
+    }
+
+    // Field of the settings of the period being edited
+    std::uint32_t period_field(FizeauProfileField day, FizeauProfileField night) const {
+        return this->is_day ? day : night;
     }
 
     // Switch to a different profile in-place, refreshing all slider positions.
     void switch_profile(FizeauProfileId new_id) {
-        if (this->pending_apply) {
-            this->config.apply();
+        // The pending edit and the profile switch are committed together,
+        // and the preview of the edit ends once they are
+        Transaction transaction;
+        if (this->pending_apply || this->pending_fields) {
+            transaction.set_profile(this->config.cur_profile_id, this->config.profile);
             this->pending_apply = false;
+            this->pending_fields = 0;
             this->apply_counter = 0;
         }
 
-        if (this->rc = this->config.open_profile(new_id); R_FAILED(this->rc))
+        bool was_previewing = std::exchange(this->is_previewing, false);
+        FZ_SCOPEGUARD([was_previewing] { if (was_previewing) fizeauEndPreview(); });
+
+        if (this->rc = this->config.open_profile(new_id); R_FAILED(this->rc)) {
+            transaction.apply();
             return;
+        }
 
         // If this profile is Dynamic, capture its real times from the sysmodule
         // (the sysmodule loaded them from config.ini on boot).  If it is Day/Night,
@@ -670,7 +760,8 @@ public:
         // Tell the sysmodule to use this profile for the current display so
         // changes are immediately visible on screen.
         bool is_external = (this->perf_mode != ApmPerformanceMode_Normal);
-        fizeauSetActiveProfileId(is_external, new_id);
+        transaction.set_active_profile_id(is_external, new_id);
+        transaction.apply();
         (is_external ? this->config.external_profile : this->config.internal_profile) = new_id;
 
         this->refresh_sliders();
@@ -762,6 +853,7 @@ public:
             Time t = TimeStepTrackBar::hour_to_time(hour);
             ps.real_dawn_begin = ps.real_dawn_end = t;
             this->config.profile.dawn_begin = this->config.profile.dawn_end = t;
+            this->pending_fields |= FizeauProfileField_DawnBegin | FizeauProfileField_DawnEnd;
             this->pending_apply = true;
         });
 
@@ -780,6 +872,7 @@ public:
             Time t = TimeStepTrackBar::hour_to_time(hour);
             ps.real_dusk_begin = ps.real_dusk_end = t;
             this->config.profile.dusk_begin = this->config.profile.dusk_end = t;
+            this->pending_fields |= FizeauProfileField_DuskBegin | FizeauProfileField_DuskEnd;
             this->pending_apply = true;
         });
 
@@ -824,7 +917,8 @@ public:
                 this->range_button->setValue(is_full(range) ? "Full" : "Limited");
                 
                 // Apply all reset values immediately
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DaySettings, FizeauProfileField_NightSettings) |
+                    FizeauProfileField_Components | FizeauProfileField_Filter);
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 
@@ -840,7 +934,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->temp_slider->setProgress((DEFAULT_TEMP - MIN_TEMP) * 100 / ((this->allow_high_temp ? MAX_TEMP : D65_TEMP) - MIN_TEMP));
                 (this->is_day ? this->config.profile.day_settings.temperature : this->config.profile.night_settings.temperature) = DEFAULT_TEMP;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DayTemperature, FizeauProfileField_NightTemperature));
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -851,6 +945,7 @@ public:
         this->temp_slider->setValueChangedListener([this](std::uint8_t val) {
             (this->is_day ? this->config.profile.day_settings.temperature : this->config.profile.night_settings.temperature) =
                 val * ((this->allow_high_temp ? MAX_TEMP : D65_TEMP) - MIN_TEMP) / 100 + MIN_TEMP;
+            this->pending_fields |= this->period_field(FizeauProfileField_DayTemperature, FizeauProfileField_NightTemperature);
             this->pending_apply = true;
         });
 
@@ -861,7 +956,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->sat_slider->setProgress((DEFAULT_SAT - MIN_SAT) * 100 / (MAX_SAT - MIN_SAT));
                 (this->is_day ? this->config.profile.day_settings.saturation : this->config.profile.night_settings.saturation) = DEFAULT_SAT;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DaySaturation, FizeauProfileField_NightSaturation));
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -872,6 +967,7 @@ public:
         this->sat_slider->setValueChangedListener([this](std::uint8_t val) {
             (this->is_day ? this->config.profile.day_settings.saturation : this->config.profile.night_settings.saturation) =
                 val * (MAX_SAT - MIN_SAT) / 100 + MIN_SAT;
+            this->pending_fields |= this->period_field(FizeauProfileField_DaySaturation, FizeauProfileField_NightSaturation);
             this->pending_apply = true;
         });
 
@@ -882,7 +978,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->hue_slider->setProgress((DEFAULT_HUE - MIN_HUE) * 100 / (MAX_HUE - MIN_HUE));
                 (this->is_day ? this->config.profile.day_settings.hue : this->config.profile.night_settings.hue) = DEFAULT_HUE;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DayHue, FizeauProfileField_NightHue));
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -893,6 +989,7 @@ public:
         this->hue_slider->setValueChangedListener([this](std::uint8_t val) {
             (this->is_day ? this->config.profile.day_settings.hue : this->config.profile.night_settings.hue) =
                 val * (MAX_HUE - MIN_HUE) / 100 + MIN_HUE;
+            this->pending_fields |= this->period_field(FizeauProfileField_DayHue, FizeauProfileField_NightHue);
             this->pending_apply = true;
         });
 
@@ -902,7 +999,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->components_bar->setProgress(Component_All);
                 this->config.profile.components = Component_All;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(FizeauProfileField_Components);
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -912,6 +1009,7 @@ public:
         });
         this->components_bar->setValueChangedListener([this](u8 val) {
             this->config.profile.components = static_cast<Component>(val);
+            this->pending_fields |= FizeauProfileField_Components;
             this->pending_apply = true;
         });
 
@@ -921,7 +1019,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->filter_bar->setProgress(Component_None);
                 this->config.profile.filter = Component_None;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(FizeauProfileField_Filter);
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -931,6 +1029,7 @@ public:
         });
         this->filter_bar->setValueChangedListener([this](u8 val) {
             this->config.profile.filter = static_cast<Component>(static_cast<Component>(val ? BIT(val - 1) : val));
+            this->pending_fields |= FizeauProfileField_Filter;
             this->pending_apply = true;
         });
 
@@ -941,7 +1040,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->contrast_slider->setProgress((DEFAULT_CONTRAST - MIN_CONTRAST) * 100 / (MAX_CONTRAST - MIN_CONTRAST));
                 (this->is_day ? this->config.profile.day_settings.contrast : this->config.profile.night_settings.contrast) = DEFAULT_CONTRAST;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DayContrast, FizeauProfileField_NightContrast));
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -952,6 +1051,7 @@ public:
         this->contrast_slider->setValueChangedListener([this](std::uint8_t val) {
             (this->is_day ? this->config.profile.day_settings.contrast : this->config.profile.night_settings.contrast) =
                 val * (MAX_CONTRAST - MIN_CONTRAST) / 100 + MIN_CONTRAST;
+            this->pending_fields |= this->period_field(FizeauProfileField_DayContrast, FizeauProfileField_NightContrast);
             this->pending_apply = true;
         });
 
@@ -962,7 +1062,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->gamma_slider->setProgress((DEFAULT_GAMMA - MIN_GAMMA) * 100 / (MAX_GAMMA - MIN_GAMMA));
                 (this->is_day ? this->config.profile.day_settings.gamma : this->config.profile.night_settings.gamma) = DEFAULT_GAMMA;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DayGamma, FizeauProfileField_NightGamma));
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -973,6 +1073,7 @@ public:
         this->gamma_slider->setValueChangedListener([this](std::uint8_t val) {
             (this->is_day ? this->config.profile.day_settings.gamma : this->config.profile.night_settings.gamma) =
                 val * (MAX_GAMMA - MIN_GAMMA) / 100 + MIN_GAMMA;
+            this->pending_fields |= this->period_field(FizeauProfileField_DayGamma, FizeauProfileField_NightGamma);
             this->pending_apply = true;
         });
 
@@ -983,7 +1084,7 @@ public:
             if (keys & HidNpadButton_Y) {
                 this->luma_slider->setProgress((DEFAULT_LUMA - MIN_LUMA) * 100 / (MAX_LUMA - MIN_LUMA));
                 (this->is_day ? this->config.profile.day_settings.luminance : this->config.profile.night_settings.luminance) = DEFAULT_LUMA;
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DayLuminance, FizeauProfileField_NightLuminance));
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 triggerSettingsFeedback();
@@ -994,6 +1095,7 @@ public:
         this->luma_slider->setValueChangedListener([this](std::uint8_t val) {
             (this->is_day ? this->config.profile.day_settings.luminance : this->config.profile.night_settings.luminance) =
                 val * (MAX_LUMA - MIN_LUMA) / 100 + MIN_LUMA;
+            this->pending_fields |= this->period_field(FizeauProfileField_DayLuminance, FizeauProfileField_NightLuminance);
             this->pending_apply = true;
         });
 
@@ -1006,7 +1108,7 @@ public:
                 else
                     range = DEFAULT_RANGE;
                 this->range_button->setValue(is_full(range) ? "Full" : "Limited");
-                this->rc = this->apply_with_override();
+                this->rc = this->apply_with_override(this->period_field(FizeauProfileField_DayRange, FizeauProfileField_NightRange));
                 this->pending_apply = false;
                 this->apply_counter = 0;
                 return true;
@@ -1071,22 +1173,35 @@ public:
         if (R_FAILED(this->rc) && this->config.cur_profile_id == FizeauProfileId_Invalid)
             tsl::changeTo<ErrorGui>(this->rc);
 
-        this->is_day = this->compute_is_day();
+        // The sysmodule signals period and display mode changes, so nothing is polled.
+        // Without the event (older sysmodule), poll display mode every ~18 frames (~300ms at 60fps)
+        if (this->has_state_event) {
+            if (this->is_state_changed.exchange(false, std::memory_order_acquire))
+                this->refresh_state();
+        } else {
+            this->is_day = this->compute_is_day();
 
-        // Poll display mode every ~18 frames (~300ms at 60fps)
-        this->display_mode_poll_counter++;
-        if (this->display_mode_poll_counter >= 18) {
-            this->display_mode_poll_counter = 0;
-            apmGetPerformanceMode(&this->perf_mode);
+            this->display_mode_poll_counter++;
+            if (this->display_mode_poll_counter >= 18) {
+                this->display_mode_poll_counter = 0;
+                apmGetPerformanceMode(&this->perf_mode);
+            }
         }
         this->display_settings_header->setValue(
             this->perf_mode == ApmPerformanceMode_Normal ? "Handheld" : "Docked", tsl::onTextColor);
 
-        // Apply changes every 3 frames (~50ms at 60fps, ~33ms at 90fps)
+        // Apply changes every 3 frames (~50ms at 60fps, ~33ms at 90fps).
+        // Settings are previewed, and stored once the sliders settle
+        bool is_settings_only = !(this->pending_fields & ~(FizeauProfileField_DaySettings | FizeauProfileField_NightSettings));
+        if (!this->pending_apply && this->is_previewing && (++this->settle_counter >= PREVIEW_SETTLE_FRAMES)) {
+            if (Result apply_rc = this->apply_with_override(); R_FAILED(apply_rc))
+                LOG("Failed to store previewed settings: %#x\n", apply_rc);
+        }
+
         if (this->pending_apply) {
             this->apply_counter++;
             if (this->apply_counter >= 3) {
-                Result apply_rc = this->apply_with_override();
+                Result apply_rc = is_settings_only ? this->preview_settings() : this->apply_with_override();
                 // Don't let a single failed apply kill the overlay
                 // Just log it and continue
                 if (R_FAILED(apply_rc)) {
@@ -1143,10 +1258,22 @@ private:
     tsl::elm::CategoryHeader *daylight_header = nullptr;
     tsl::elm::CategoryHeader *display_settings_header = nullptr;
     int display_mode_poll_counter = 0;
+
+    // Signaled by the sysmodule on state changes, the generation is that of the last state we saw.
+    // The thread waiting on the event sets the flag, and is woken up to exit by the user event
+    Event state_event = {};
+    bool has_state_event = false;
+    std::uint32_t state_generation = 0;
+    Thread state_thread = {};
+    UEvent exit_event = {};
+    std::atomic<bool> is_state_changed = false;
     
     // Frame-based throttling (simpler than time-based)
     int apply_counter;
     bool pending_apply;
+    std::uint32_t pending_fields = 0; // FizeauProfileField changed since the last apply
+    bool is_previewing = false;       // The sysmodule shows edits that are not stored yet
+    int settle_counter = 0;           // Frames since the last preview
 
     // Per-profile period state: override enum + original dusk/dawn times
     std::array<ProfilePeriodState, FizeauProfileId_Total> period_states = {};
@@ -17,7 +17,10 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <array>
+#include <type_traits>
 
 #include <common.hpp>
 
@@ -25,13 +28,42 @@
 
 namespace fz {
 
-enum FizeauProfileState: std::uint32_t {
-    Day,
-    Night,
+// Value with a modification counter, bumped by each write. Everything runs on the reactor thread,
+// so readers only need the counter to know whether their copy is outdated
+template <typename T> requires std::is_trivially_copyable_v<T>
+class Versioned {
+    public:
+        constexpr Versioned() = default;
+
+        std::uint32_t get_version() const {
+            return this->version;
+        }
+
+        // Returns the version of the copied value
+        std::uint32_t read(T &out) const {
+            std::memcpy(&out, &this->value, sizeof(T));
+            return this->version;
+        }
+
+        // Modifies the value in place
+        template <typename F>
+        void write(F &&func) {
+            func(this->value);
+            ++this->version;
+        }
+
+        const T &peek() const {
+            return this->value;
+        }
+
+    private:
+        std::uint32_t version = 0;
+        T value = {};
 };
 
-struct Context {
-    bool is_lite = false, is_active = false;
+// State set over ipc, versioned so that commits only copy it after a change
+struct ContextSnapshot {
+    bool is_active = false;
 
     FizeauProfileId internal_profile = FizeauProfileId_Invalid,
         external_profile = FizeauProfileId_Invalid;
@@ -54,10 +86,18 @@ struct Context {
             .night_settings = Config::default_settings,
         },
     };
+};
+
+struct Context {
+    bool is_lite = false;
+
+    Versioned<ContextSnapshot> shared = {};
 
-    std::array<FizeauProfileState, FizeauProfileId_Total> profile_states = {};
+    // Owned by the profile manager, schedule segment of each profile at its last commit
+    std::array<std::uint32_t, FizeauProfileId_Total> profile_segments = {};
 
     DisplayController::CmuShadow cmu_shadow_internal = {}, cmu_shadow_external = {};
+    DisplayController::CmuStages cmu_stages_internal = {}, cmu_stages_external = {};
 };
 
 } // namespace fz
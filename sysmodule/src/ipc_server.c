@@ -99,14 +99,22 @@ static Result _ipcServerParseRequest(IpcServerRequest* r)
     return 0;
 }
 
-static void _ipcServerPrepareResponse(Result rc, void* data, size_t dataSize)
+static void _ipcServerPrepareResponse(Result rc, void* data, size_t dataSize, Handle copyHandle)
 {
+    bool hasCopyHandle = R_SUCCEEDED(rc) && copyHandle != INVALID_HANDLE;
+
     u8* base = armGetTls();
     HipcRequest hipc = hipcMakeRequestInline(base,
         .type = CmifCommandType_Request,
         .num_data_words = (sizeof(IpcServerRawHeader) + dataSize + 0x10) / 4,
+        .num_copy_handles = hasCopyHandle ? 1 : 0,
     );
 
+    if(hasCopyHandle)
+    {
+        hipc.copy_handles[0] = copyHandle;
+    }
+
     IpcServerRawHeader* rawHeader = cmifGetAlignedDataStart(hipc.data_words, base);
     rawHeader->magic = CMIF_OUT_HEADER_MAGIC;
     rawHeader->result = rc;
@@ -134,12 +142,14 @@ static Result _ipcServerProcessSession(IpcServer* server, IpcServerRequestHandle
     IpcServerRequest r;
     size_t dataSize = 0;
     u8 data[IPC_SERVER_EXT_RESPONSE_MAX_DATA_SIZE];
+    Handle copyHandle = INVALID_HANDLE;
     bool close = false;
 
     Result rc = svcReplyAndReceive(&unusedIndex, &server->handles[handleIndex], 1, 0, UINT64_MAX);
     if(R_SUCCEEDED(rc))
     {
         rc = _ipcServerParseRequest(&r);
+        r.session = server->handles[handleIndex];
     }
 
     if(R_SUCCEEDED(rc))
@@ -148,17 +158,18 @@ static Result _ipcServerProcessSession(IpcServer* server, IpcServerRequestHandle
         {
             case CmifCommandType_Request:
                 _ipcServerPrepareResponse(
-                    handler(userdata, &r, data, &dataSize),
+                    handler(userdata, &r, data, &dataSize, &copyHandle),
                     data,
-                    dataSize
+                    dataSize,
+                    copyHandle
                 );
                 break;
             case CmifCommandType_Close:
-                _ipcServerPrepareResponse(0, NULL, 0);
+                _ipcServerPrepareResponse(0, NULL, 0, INVALID_HANDLE);
                 close = true;
                 break;
             default:
-                _ipcServerPrepareResponse(MAKERESULT(11, 403), NULL, 0);
+                _ipcServerPrepareResponse(MAKERESULT(11, 403), NULL, 0, INVALID_HANDLE);
                 break;
         }
 
@@ -177,28 +188,32 @@ static Result _ipcServerProcessSession(IpcServer* server, IpcServerRequestHandle
     return rc;
 }
 
-Result ipcServerProcess(IpcServer* server, IpcServerRequestHandler handler, void* userdata)
+Result ipcServerProcessHandle(IpcServer* server, IpcServerRequestHandler handler, void* userdata, s32 handleIndex)
 {
-    s32 handleIndex = -1;
-    Result rc = svcWaitSynchronization(&handleIndex, server->handles, server->count, UINT64_MAX);
+    if(handleIndex < 0 || handleIndex >= server->count)
+    {
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    }
 
-    if(R_SUCCEEDED(rc) && (handleIndex < 0 || handleIndex >= server->count))
+    if(handleIndex)
+    {
+        return _ipcServerProcessSession(server, handler, userdata, handleIndex);
+    }
+    else
     {
-        rc = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+        return _ipcServerProcessNewSession(server);
     }
+}
+
+Result ipcServerProcess(IpcServer* server, IpcServerRequestHandler handler, void* userdata)
+{
+    s32 handleIndex = -1;
+    Result rc = svcWaitSynchronization(&handleIndex, server->handles, server->count, UINT64_MAX);
 
     if(R_SUCCEEDED(rc))
     {
-        if(handleIndex)
-        {
-            rc = _ipcServerProcessSession(server, handler, userdata, handleIndex);
-        }
-        else
-        {
-            rc = _ipcServerProcessNewSession(server);
-        }
+        rc = ipcServerProcessHandle(server, handler, userdata, handleIndex);
     }
 
     return rc;
 }
-
@@ -48,13 +48,16 @@ typedef struct
 {
     HipcParsedRequest hipc;
     IpcServerRequestData data;
+    Handle session;
 } IpcServerRequest;
 
-typedef Result (*IpcServerRequestHandler)(void* userdata, const IpcServerRequest* r, u8* out_data, size_t* out_dataSize);
+// out_copyHandle is INVALID_HANDLE on entry, handlers set it to return a copy of one of their handles
+typedef Result (*IpcServerRequestHandler)(void* userdata, const IpcServerRequest* r, u8* out_data, size_t* out_dataSize, Handle* out_copyHandle);
 
 Result ipcServerInit(IpcServer* server, const char* name, u32 max_sessions);
 Result ipcServerExit(IpcServer* server);
 Result ipcServerProcess(IpcServer* server, IpcServerRequestHandler handler, void* userdata);
+Result ipcServerProcessHandle(IpcServer* server, IpcServerRequestHandler handler, void* userdata, s32 handleIndex);
 Result ipcServerParseCommand(const IpcServerRequest* r, size_t* out_datasize, void** out_data, u64* out_cmd);
 
 #ifdef __cplusplus
@@ -25,6 +25,7 @@
 #include "context.hpp"
 #include "profile.hpp"
 #include "nvdisp.hpp"
+#include "reactor.hpp"
 #include "server.hpp"
 
 #if defined(DEBUG) && defined(TWILI)
@@ -119,6 +120,9 @@ static constinit fz::DisplayController disp    = {};
 static constinit fz::ProfileManager    profile(context, disp);
 static constinit fz::Server            server (context, profile);
 
+// Everything runs on the main thread, which waits on the sessions, the system events and the profile timers at once
+static constinit fz::Reactor<fz::Server, fz::ProfileManager> reactor(server, profile);
+
 FsFile find_config_file(FsFileSystem fs) {
     FsFile fp = {};
     char buf[FS_MAX_PATH];
@@ -156,7 +160,7 @@ bool parse_config() {
     config.parse_profile_switch_action = +[](fz::Config *self, FizeauProfileId profile_id) {
         if (self->cur_profile_id == FizeauProfileId_Invalid)
             return;
-        context.profiles[self->cur_profile_id] = self->profile;
+        context.shared.write([self](auto &shared) { shared.profiles[self->cur_profile_id] = self->profile; });
         self->profile = {};
     };
 
@@ -184,12 +188,14 @@ bool parse_config() {
     if (auto res = ini_parse_stream(reader, &read_ctx, fz::Config::ini_handler, &config); !res) {
         // The switch action only fires when entering a new section, so the last
         // profile parsed never gets flushed automatically — do it here.
-        if (config.cur_profile_id != FizeauProfileId_Invalid)
-            context.profiles[config.cur_profile_id] = config.profile;
-
-        context.is_active        = config.active;
-        context.internal_profile = config.internal_profile;
-        context.external_profile = config.external_profile;
+        context.shared.write([&config](auto &shared) {
+            if (config.cur_profile_id != FizeauProfileId_Invalid)
+                shared.profiles[config.cur_profile_id] = config.profile;
+
+            shared.is_active        = config.active;
+            shared.internal_profile = config.internal_profile;
+            shared.external_profile = config.external_profile;
+        });
     }
 
     return true;
@@ -213,13 +219,13 @@ int main(int argc, char **argv) {
         diagAbortWithResult(rc);
 
     if (parse_config())
-        profile.apply();
+        profile.request_commit();
 
     LOG("Starting server\n");
     if (auto rc = server.initialize(); R_FAILED(rc))
         diagAbortWithResult(rc);
 
-    server.loop();
+    reactor.run();
 
     server .finalize();
     profile.finalize();
@@ -17,6 +17,7 @@
 
 #include <cmath>
 #include <algorithm>
+#include <span>
 #include <common.hpp>
 
 #include "color.hpp"
@@ -27,21 +28,60 @@ namespace fz {
 
 namespace {
 
-Cmu calculate_cmu(FizeauSettings &settings, Component components, Component filter) {
+// Fixed LUT1, corresponding to the gamma of the incoming data
+constexpr auto default_lut_1 = [] {
+    DisplayController::Lut1 lut = {};
+    degamma_ramp(lut.data(), lut.size(), DEFAULT_GAMMA, 12);
+    return lut;
+}();
+
+// Hashes the bytes of each element, in little-endian order
+constexpr std::uint32_t fnv1a(const auto &data, std::uint32_t hash = 0x811c9dc5) {
+    for (auto v: data) {
+        for (std::size_t i = 0; i < sizeof(v); ++i)
+            hash = (hash ^ ((static_cast<std::uint32_t>(v) >> (i * 8)) & 0xff)) * 0x01000193;
+    }
+    return hash;
+}
+
+// Values and hash of the runtime output of gamma_ramp(degamma, ..., DEFAULT_GAMMA, 12)
+static_assert((default_lut_1.front() == 0) && (default_lut_1[128] == 884) && (default_lut_1.back() == 4095));
+static_assert(fnv1a(default_lut_1) == 0xdafc14ad);
+
+// Result of calculate_cmu with Config::default_settings and no filter, which only has identity transforms
+constexpr Cmu default_cmu = [] {
     Cmu cmu;
+    cmu.lut_1 = default_lut_1;
+
+    auto &set = Config::default_settings;
+    regamma_ramp(cmu.lut_2.data(), 512, set.gamma, 8, 0.0f, 0.125f, 0.0f, set.luminance, set.range);
+    regamma_ramp(cmu.lut_2.data() + 512, cmu.lut_2.size() - 512, set.gamma, 8, 0.125f, 1.0f, 0.0f, set.luminance, set.range);
+
+    cmu.csc_modified = cmu.lut1_modified = cmu.lut2_modified = 0;
+    return cmu;
+}();
+
+static_assert(fnv1a(default_cmu.lut_2) == 0x234880ac);
+
+using CmuStages = DisplayController::CmuStages;
+
+void update_csc_stage(CmuStages &stages, const FizeauSettings &settings, Component components, Component filter) {
+    auto &stage = stages.csc;
+    if (stage.is_valid && (stage.temperature == settings.temperature) && (stage.saturation == settings.saturation) &&
+            (stage.hue == settings.hue) && (stage.contrast == settings.contrast) &&
+            (stage.components == components) && (stage.filter == filter))
+        return;
 
     // Calculate initial coefficients
     auto coeffs = filter_matrix(filter);
 
     // Apply temperature color correction
     ColorMatrix m = {};
-    std::tie(m[0], m[4], m[8]) = whitepoint(settings.temperature);
-    m[0] = degamma(m[0], 2.4f), m[4] = degamma(m[4], 2.4f), m[8] = degamma(m[8], 2.4f);
+    std::tie(m[0], m[4], m[8]) = whitepoint_linear(settings.temperature);
     coeffs = dot(coeffs, m);
 
     // Apply contrast multiplier
-    auto c = contrast_slant(settings.contrast);
-    m[0] = m[4] = m[8] = c;
+    m[0] = m[4] = m[8] = contrast_slant(settings.contrast);
     coeffs = dot(coeffs, m);
 
     // Apply saturation
@@ -50,57 +90,189 @@ Cmu calculate_cmu(FizeauSettings &settings, Component components, Component filt
     // Apply hue rotation
     coeffs = dot(coeffs, hue_matrix(settings.hue));
 
-    // Copy calculated coefficients to the cmu matrix if they are enabled
+    // Copy calculated coefficients if they are enabled, otherwise leave the identity
+    stage.coeffs = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
     if (components & Component_Red)
-        std::copy_n(coeffs.begin() + 0, 3, &cmu.krr);
+        std::copy_n(coeffs.begin() + 0, 3, stage.coeffs.begin() + 0);
     if (components & Component_Green)
-        std::copy_n(coeffs.begin() + 3, 3, &cmu.krg);
+        std::copy_n(coeffs.begin() + 3, 3, stage.coeffs.begin() + 3);
     if (components & Component_Blue)
-        std::copy_n(coeffs.begin() + 6, 3, &cmu.krb);
+        std::copy_n(coeffs.begin() + 6, 3, stage.coeffs.begin() + 6);
 
-    // Calculate gamma ramps, with contrast offset
-    float off = (1.0f - c) / 2.0f;
-    degamma_ramp(cmu.lut_1.data(), cmu.lut_1.size(), DEFAULT_GAMMA, 12);                                // Set the LUT1 with a fixed gamma corresponding to the incoming data
-    regamma_ramp(cmu.lut_2.data(), 512, settings.gamma, 8, 0.0f, 0.125f, off);                          // Set the first part of LUT2 (more precision in darker components)
-    regamma_ramp(cmu.lut_2.data() + 512, cmu.lut_2.size() - 512, settings.gamma, 8, 0.125f, 1.0f, off); // Set the second part of LUT2 (less precision in brighter components)
+    stage.temperature = settings.temperature, stage.saturation = settings.saturation, stage.hue = settings.hue;
+    stage.contrast    = settings.contrast,    stage.components = components,          stage.filter = filter;
+    stage.is_valid    = true;
+}
 
-    // Apply luminance
-    apply_luma(cmu.lut_2.data(), cmu.lut_2.size(), 8, settings.luminance);
+void update_regamma_stage(CmuStages &stages, const FizeauSettings &settings) {
+    auto &stage = stages.regamma;
+    if (stage.is_valid && (stage.gamma == settings.gamma) && (stage.contrast == settings.contrast))
+        return;
 
-    // Apply color range
-    apply_range(cmu.lut_2.data(), cmu.lut_2.size(), 8,
-        settings.range.lo, std::min(settings.range.hi, cmu.lut_2.back() / 255.0f)); // Adjust max for luma
+    // Calculate the LUT2 in two parts (more precision in darker components), with contrast offset
+    float off = (1.0f - contrast_slant(settings.contrast)) / 2.0f;
+    stage.top = regamma_samples(stage.samples.data(), 512, settings.gamma, 0.0f, 0.125f, off);
+    regamma_samples(stage.samples.data() + 512, stage.samples.size() - 512, settings.gamma, 0.125f, 1.0f, off);
 
-    return cmu;
+    stage.gamma = settings.gamma, stage.contrast = settings.contrast;
+    stage.is_valid = true;
+
+    // Invalidate the dependent stage
+    stages.luma_range.is_valid = false;
+}
+
+void update_luma_range_stage(CmuStages &stages, const FizeauSettings &settings) {
+    auto &stage = stages.luma_range;
+    if (stage.is_valid && (stage.luminance == settings.luminance) && (stage.range == settings.range))
+        return;
+
+    // The range top is adjusted for luma
+    luma_range_ramp(stages.regamma.samples.data(), stage.lut.data(), stage.lut.size(), 8,
+        stages.regamma.top, settings.luminance, settings.range);
+    stage.hash = fnv1a(stage.lut);
+
+    stage.luminance = settings.luminance, stage.range = settings.range;
+    stage.is_valid = true;
+}
+
+void update_stages(CmuStages &stages, const FizeauSettings &settings, Component components, Component filter) {
+    update_csc_stage(stages, settings, components, filter);
+    update_regamma_stage(stages, settings);
+    update_luma_range_stage(stages, settings);
+}
+
+void calculate_cmu(Cmu &cmu, CmuStages &stages, const FizeauSettings &settings, Component components, Component filter) {
+    update_stages(stages, settings, components, filter);
+
+    cmu.reset();
+    std::copy(stages.csc.coeffs.begin(), stages.csc.coeffs.end(), &cmu.krr);
+    cmu.lut_1 = default_lut_1; // Set the LUT1 with a fixed gamma corresponding to the incoming data
+    cmu.lut_2 = stages.luma_range.lut;
+}
+
+std::int32_t quantize_step(float value, float origin) {
+    return static_cast<std::int32_t>(std::lround((value - origin) * CmuCache::Resolution));
+}
+
+float quantize_value(float value, float origin) {
+    return origin + static_cast<float>(quantize_step(value, origin)) / CmuCache::Resolution;
 }
 
 } // namespace
 
-Result DisplayController::disable(bool external) const {
-    Cmu cmu(false);
+FizeauSettings CmuCache::quantize(const FizeauSettings &settings) {
+    auto &def = Config::default_settings;
+    return {
+        .temperature = settings.temperature,
+        .saturation  = quantize_value(settings.saturation, def.saturation),
+        .hue         = quantize_value(settings.hue,        def.hue),
+        .contrast    = quantize_value(settings.contrast,   def.contrast),
+        .gamma       = quantize_value(settings.gamma,      def.gamma),
+        .luminance   = quantize_value(settings.luminance,  def.luminance),
+        .range       = {
+                       quantize_value(settings.range.lo,   def.range.lo),
+                       quantize_value(settings.range.hi,   def.range.hi),
+        },
+    };
+}
+
+CmuCache::Key CmuCache::make_key(const FizeauSettings &settings, Component components, Component filter) {
+    auto &def = Config::default_settings;
+    auto step = [](float v, float origin) { return static_cast<std::uint32_t>(quantize_step(v, origin)); };
+
+    return {
+        static_cast<std::uint32_t>(settings.temperature),
+        step(settings.saturation, def.saturation),
+        step(settings.hue,        def.hue),
+        step(settings.contrast,   def.contrast),
+        step(settings.gamma,      def.gamma),
+        step(settings.luminance,  def.luminance),
+        step(settings.range.lo,   def.range.lo),
+        step(settings.range.hi,   def.range.hi),
+        static_cast<std::uint32_t>(components | (filter << 8)),
+    };
+}
+
+Cmu *CmuCache::find(const Key &key, bool is_counted) {
+    auto hash = fnv1a(key);
+
+    for (auto &entry: this->entries) {
+        if (entry.is_valid && (entry.hash == hash) && (entry.key == key)) {
+            entry.last_use = ++this->use_counter;
+            this->hits += is_counted;
+            return &entry.cmu;
+        }
+    }
+
+    this->misses += is_counted;
+    return nullptr;
+}
+
+Cmu &CmuCache::insert(const Key &key) {
+    // Invalid entries have a last use of 0, and get picked first
+    auto &entry = *std::min_element(this->entries.begin(), this->entries.end(),
+        [](const Entry &l, const Entry &r) { return l.last_use < r.last_use; });
+
+    entry.key      = key;
+    entry.hash     = fnv1a(key);
+    entry.last_use = ++this->use_counter;
+    entry.is_valid = true;
+    return entry.cmu;
+}
+
+Result DisplayController::disable(bool external) {
+    auto &cmu = this->scratch_cmu;
+    cmu.reset(false);
 
-    if (auto rc = nvioctlNvDisp_SetCmu(!external ? this->disp0_fd : this->disp1_fd, &cmu))
+    if (auto rc = this->submit_cmu(external, cmu); R_FAILED(rc))
         return rc;
 
     if (external)
         return 0;
 
-    AviInfoframe infoframe;
-    if (auto rc = nvioctlNvDisp_GetAviInfoframe(this->disp1_fd, &infoframe); R_FAILED(rc))
-        return rc;
+    return this->set_rgb_quant(RgbQuantRange::Default);
+}
 
-    infoframe.rgb_quant = RgbQuantRange::Default;
-    if (auto rc = nvioctlNvDisp_SetAviInfoframe(this->disp1_fd, &infoframe); R_FAILED(rc))
-        return rc;
+Cmu *DisplayController::get_cmu(const FizeauSettings &settings, Component components, Component filter, CmuStages &stages,
+        bool is_counted) {
+    auto quantized = CmuCache::quantize(settings);
+    auto key = CmuCache::make_key(quantized, components, filter);
 
-    return 0;
+    auto *cmu = this->cmu_cache.find(key, is_counted);
+    if (!cmu) {
+        cmu = &this->cmu_cache.insert(key);
+
+        // Default settings result in a fixed cmu, computed at compile time
+        if ((quantized == Config::default_settings) && (filter == Component_None))
+            *cmu = default_cmu;
+        else
+            calculate_cmu(*cmu, stages, quantized, components, filter);
+    }
+
+    return cmu;
 }
 
-Result DisplayController::apply_color_profile(bool external, FizeauSettings &settings,
-        Component components, Component filter, CmuShadow &shadow) const {
-    Cmu cmu = calculate_cmu(settings, components, filter);
+Result DisplayController::submit_cmu(bool external, Cmu &cmu) {
+    auto &committed = this->committed_cmus[external];
+
+    // Skip commits identical to the last one, unless the hardware state was invalidated since
+    auto hash = fnv1a(cmu.lut_2, fnv1a(cmu.lut_1, fnv1a(std::span(&cmu.krr, 9), fnv1a(std::array{ cmu.enable }))));
+    if (committed.is_valid && (committed.hash == hash)) {
+        ++this->commit_stats.nb_cmu_skipped;
+        return 0;
+    }
 
-    if (auto rc = nvioctlNvDisp_SetCmu(!external ? this->disp0_fd : this->disp1_fd, &cmu); R_FAILED(rc))
+    committed.is_valid = false;
+    if (auto rc = this->backend->commit(external, cmu); R_FAILED(rc))
+        return this->record_failure(rc);
+
+    committed.is_valid = true, committed.hash = hash;
+    ++this->commit_stats.nb_cmu_issued;
+    return 0;
+}
+
+Result DisplayController::commit_cmu(bool external, Cmu &cmu, CmuShadow &shadow) {
+    if (auto rc = this->submit_cmu(external, cmu); R_FAILED(rc))
         return rc;
 
     // Save cmu shadow, to be used for change detection
@@ -110,24 +282,152 @@ Result DisplayController::apply_color_profile(bool external, FizeauSettings &set
     return 0;
 }
 
-Result DisplayController::set_hdmi_color_range(bool external, ColorRange range) const {
-    if (external)
+Result DisplayController::apply_color_profile(bool external, FizeauSettings &settings,
+        Component components, Component filter, CmuShadow &shadow, CmuStages &stages) {
+    return this->commit_cmu(external, *this->get_cmu(settings, components, filter, stages), shadow);
+}
+
+Result DisplayController::apply_uncached_color_profile(bool external, FizeauSettings &settings,
+        Component components, Component filter, CmuShadow &shadow, CmuStages &stages) {
+    // Cached cmus are still used, eg. when previewing the settings shown by the profile
+    auto quantized = CmuCache::quantize(settings);
+    if (auto *cached = this->cmu_cache.find(CmuCache::make_key(quantized, components, filter), false))
+        return this->commit_cmu(external, *cached, shadow);
+
+    auto &cmu = this->scratch_cmu;
+    calculate_cmu(cmu, stages, quantized, components, filter);
+    return this->commit_cmu(external, cmu, shadow);
+}
+
+Result DisplayController::apply_interpolated_color_profile(bool external, FizeauSettings &from, FizeauSettings &to, float factor,
+        Component components, Component filter, CmuShadow &shadow, CmuStages &stages) {
+    // The endpoints stay in the cache for the duration of the transition.
+    // Looking up the second one cannot evict the first, since it was just used
+    auto *cmu_from = this->get_cmu(from, components, filter, stages);
+    auto *cmu_to   = this->get_cmu(to,   components, filter, stages);
+
+    auto lerp = CmuLerp(factor);
+
+    auto &cmu = this->scratch_cmu;
+    cmu.reset();
+
+    for (std::size_t i = 0; i < 9; ++i)
+        (&cmu.krr)[i] = lerp(static_cast<std::int16_t>((&cmu_from->krr)[i]), static_cast<std::int16_t>((&cmu_to->krr)[i]));
+
+    for (std::size_t i = 0; i < cmu.lut_1.size(); ++i)
+        cmu.lut_1[i] = lerp(cmu_from->lut_1[i], cmu_to->lut_1[i]);
+
+    for (std::size_t i = 0; i < cmu.lut_2.size(); ++i)
+        cmu.lut_2[i] = lerp(cmu_from->lut_2[i], cmu_to->lut_2[i]);
+
+    return this->commit_cmu(external, cmu, shadow);
+}
+
+Result DisplayController::apply_dimming_step(bool external, FizeauSettings &settings, Luminance luma, float factor,
+        Component components, Component filter, CmuShadow &shadow, CmuStages &stages) {
+    // Luminance only affects LUT2, so both endpoints share the rest of the cmu.
+    // They stay in the cache for the duration of the fade, each step then only costs one pass over LUT2
+    auto dimmed = settings;
+    dimmed.luminance = luma;
+
+    auto *cmu_base   = this->get_cmu(settings, components, filter, stages);
+    auto *cmu_dimmed = this->get_cmu(dimmed,   components, filter, stages);
+
+    auto lerp = CmuLerp(factor);
+
+    auto &cmu = this->scratch_cmu;
+    cmu = *cmu_base;
+
+    for (std::size_t i = 0; i < cmu.lut_2.size(); ++i)
+        cmu.lut_2[i] = lerp(cmu_base->lut_2[i], cmu_dimmed->lut_2[i]);
+
+    return this->commit_cmu(external, cmu, shadow);
+}
+
+Result DisplayController::apply_interpolated_dimming_step(bool external, FizeauSettings &from, FizeauSettings &to, float factor,
+        Luminance luma, float dim_level, Component components, Component filter, CmuShadow &shadow, CmuStages &stages) {
+    auto from_dimmed = from, to_dimmed = to;
+    from_dimmed.luminance = to_dimmed.luminance = luma;
+
+    auto *cmu_from        = this->get_cmu(from,        components, filter, stages);
+    auto *cmu_to          = this->get_cmu(to,          components, filter, stages);
+    auto *cmu_from_dimmed = this->get_cmu(from_dimmed, components, filter, stages);
+    auto *cmu_to_dimmed   = this->get_cmu(to_dimmed,   components, filter, stages);
+
+    auto lerp = CmuLerp(factor), dim = CmuLerp(dim_level);
+
+    auto &cmu = this->scratch_cmu;
+    cmu.reset();
+
+    for (std::size_t i = 0; i < 9; ++i)
+        (&cmu.krr)[i] = lerp(static_cast<std::int16_t>((&cmu_from->krr)[i]), static_cast<std::int16_t>((&cmu_to->krr)[i]));
+
+    for (std::size_t i = 0; i < cmu.lut_1.size(); ++i)
+        cmu.lut_1[i] = lerp(cmu_from->lut_1[i], cmu_to->lut_1[i]);
+
+    for (std::size_t i = 0; i < cmu.lut_2.size(); ++i)
+        cmu.lut_2[i] = dim(lerp(cmu_from->lut_2[i], cmu_to->lut_2[i]), lerp(cmu_from_dimmed->lut_2[i], cmu_to_dimmed->lut_2[i]));
+
+    return this->commit_cmu(external, cmu, shadow);
+}
+
+std::uint32_t DisplayController::hash_color_profile(const FizeauSettings &settings,
+        Component components, Component filter, CmuStages &stages) {
+    // LUT1 is fixed, so only the csc and LUT2 are hashed.
+    // This assumes the default cmu matches the calculated one, which is checked above
+    update_stages(stages, CmuCache::quantize(settings), components, filter);
+    return fnv1a(stages.csc.coeffs, stages.luma_range.hash);
+}
+
+std::int32_t DisplayController::next_interpolated_change(const FizeauSettings &from, const FizeauSettings &to,
+        std::int32_t step, Component components, Component filter, CmuStages &stages) {
+    auto *cmu_from = this->get_cmu(from, components, filter, stages, false);
+    auto *cmu_to   = this->get_cmu(to,   components, filter, stages, false);
+
+    // LUT1 is fixed, so only the csc and LUT2 can change
+    auto next = CmuLerp::One + 1;
+    for (std::size_t i = 0; i < 9; ++i)
+        next = std::min(next, CmuLerp::next_change(static_cast<std::int16_t>((&cmu_from->krr)[i]),
+            static_cast<std::int16_t>((&cmu_to->krr)[i]), step));
+
+    for (std::size_t i = 0; i < cmu_from->lut_2.size(); ++i)
+        next = std::min(next, CmuLerp::next_change(cmu_from->lut_2[i], cmu_to->lut_2[i], step));
+
+    return next;
+}
+
+Result DisplayController::set_rgb_quant(RgbQuantRange rgb_quant) {
+    // Each update costs two ioctls, skip them when the value hasn't changed
+    if (this->is_rgb_quant_valid && (this->committed_rgb_quant == rgb_quant)) {
+        ++this->commit_stats.nb_infoframe_skipped;
         return 0;
+    }
 
-    auto is_limited = [](const ColorRange &range) {
-        return (range.lo >= MIN_LIMITED_RANGE) && (range.hi <= MAX_LIMITED_RANGE);
-    };
+    this->is_rgb_quant_valid = false;
 
     AviInfoframe infoframe;
     if (auto rc = nvioctlNvDisp_GetAviInfoframe(this->disp1_fd, &infoframe); R_FAILED(rc))
-        return rc;
+        return this->record_failure(rc);
 
-    infoframe.rgb_quant = is_limited(range) ? RgbQuantRange::Limited : RgbQuantRange::Full;
+    infoframe.rgb_quant = rgb_quant;
 
     if (auto rc = nvioctlNvDisp_SetAviInfoframe(this->disp1_fd, &infoframe); R_FAILED(rc))
-        return rc;
+        return this->record_failure(rc);
 
+    this->is_rgb_quant_valid = true, this->committed_rgb_quant = rgb_quant;
+    ++this->commit_stats.nb_infoframe_issued;
     return 0;
 }
 
+Result DisplayController::set_hdmi_color_range(bool external, ColorRange range) {
+    if (external)
+        return 0;
+
+    auto is_limited = [](const ColorRange &range) {
+        return (range.lo >= MIN_LIMITED_RANGE) && (range.hi <= MAX_LIMITED_RANGE);
+    };
+
+    return this->set_rgb_quant(is_limited(range) ? RgbQuantRange::Limited : RgbQuantRange::Full);
+}
+
 } // namespace fz
@@ -23,11 +23,16 @@
 #include <atomic>
 #include <bit>
 #include <concepts>
+#include <new>
+#include <tuple>
+#include <utility>
 
 #include <switch.h>
 
 #include <common.hpp>
 
+#include "t210_regs.hpp"
+
 namespace fz {
 
 // Represents a fixed-point fractional number
@@ -82,12 +87,12 @@ struct Cmu {
                  krg, kgg, kbg,
                  krb, kgb, kbb;
 
-    __nv_in std::array<std::uint16_t, 256> lut_1;
-    __nv_in std::array<std::uint16_t, 960> lut_2;
+    __nv_in std::array<std::uint16_t, 256> lut_1 = {};
+    __nv_in std::array<std::uint16_t, 960> lut_2 = {};
 
-    __nv_out std::uint16_t csc_modified;
-    __nv_out std::uint16_t lut1_modified;
-    __nv_out std::uint16_t lut2_modified;
+    __nv_out std::uint16_t csc_modified  = 0;
+    __nv_out std::uint16_t lut1_modified = 0;
+    __nv_out std::uint16_t lut2_modified = 0;
 
     constexpr Cmu(bool enable = true, QS18 krr = 1.0, QS18 kgg = 1.0, QS18 kbb = 1.0):
         enable(enable), krr(krr), kgg(kgg), kbb(kbb) { }
@@ -143,6 +148,236 @@ static inline Result nvioctlNvDisp_SetAviInfoframe(u32 fd, AviInfoframe *infofra
     return nvIoctl(fd, _NV_IOW(2, 17, AviInfoframe), infoframe);
 }
 
+// Interface of the ways of committing a cmu to the display controllers
+class CmuBackend {
+    public:
+        virtual Result commit(bool external, Cmu &cmu) = 0;
+
+        // Notifies the backend that the hardware state may have been changed externally
+        virtual void invalidate(bool) { }
+
+    protected:
+        ~CmuBackend() = default;
+};
+
+// Submits the whole cmu to nvdrv
+class NvdrvCmuBackend final: public CmuBackend {
+    public:
+        constexpr NvdrvCmuBackend(const std::uint32_t &disp0_fd, const std::uint32_t &disp1_fd):
+            disp0_fd(disp0_fd), disp1_fd(disp1_fd) { }
+
+        Result commit(bool external, Cmu &cmu) override {
+            // The ioctl only writes back to the output fields, so cached cmus can be submitted directly
+            return nvioctlNvDisp_SetCmu(!external ? this->disp0_fd : this->disp1_fd, &cmu);
+        }
+
+    private:
+        const std::uint32_t &disp0_fd, &disp1_fd;
+};
+
+// Registers of DISPLAY_A (internal) and DISPLAY_B (external), through the io mappings of the sysmodule
+struct MmioRegisterFile {
+    // Register writes are latched on the next vblank, a missed one is given up on after two frames
+    constexpr static std::uint64_t LatchPollNs = 1'000'000, LatchTimeoutNs = 34'000'000;
+
+    std::uint64_t clock_va_base = 0, disp_va_base = 0;
+
+    // Registers of clock gated controllers can't be accessed
+    bool is_accessible(bool external) const {
+        return READ(this->clock_va_base + CLK_RST_CONTROLLER_CLK_OUT_ENB_L) & (!external ? CLK_ENB_DISP1 : CLK_ENB_DISP2);
+    }
+
+    std::uint32_t read(bool external, std::uint32_t off) const {
+        return READ(this->disp_va_base + (external ? DISP_B_OFFSET : 0) + off);
+    }
+
+    void write(bool external, std::uint32_t off, std::uint32_t val) const {
+        WRITE(this->disp_va_base + (external ? DISP_B_OFFSET : 0) + off, val);
+    }
+
+    // Waits for the hardware to clear the activation request, returns false on timeout
+    bool wait_latch(bool external) const {
+        for (std::uint64_t waited = 0; this->read(external, DC_CMD_STATE_CONTROL) & GENERAL_ACT_REQ; waited += LatchPollNs) {
+            if (waited >= LatchTimeoutNs)
+                return false;
+            svcSleepThread(LatchPollNs);
+        }
+        return true;
+    }
+};
+
+// Writes the registers that differ from the last committed cmu, and latches them, following the sequence of the nvdisp
+// driver: the cmu is disabled while it is programmed, the update is activated, then the cmu is reenabled.
+// Commits go through the fallback when the hardware state is unknown (eg. after a reset), the controller is clock gated,
+// the cmu is being disabled, or the latch timed out.
+//
+// This bypasses nvdrv, whose copy of the cmu goes stale. It is only reprogrammed by nvdrv when the display controller
+// gets reinitialized (eg. on operation mode changes or waking up), which the watchdog detects as a reset: the state is
+// then invalidated, and the next commit goes through nvdrv in full, refreshing its copy.
+// Disabled by default, build with FZ_CMU_REGISTER_COMMITS to use it
+template <typename Regs>
+class RegisterCmuBackend final: public CmuBackend {
+    public:
+        constexpr RegisterCmuBackend(Regs &regs, CmuBackend &fallback): regs(regs), fallback(fallback) { }
+
+        Result commit(bool external, Cmu &cmu) override {
+            auto &shadow = this->shadows[external];
+
+            auto control = this->regs.is_accessible(external) ? this->regs.read(external, DC_DISP_DISP_COLOR_CONTROL) : 0;
+            if (!shadow.is_valid || !cmu.enable || !(control & CMU_ENABLE))
+                return this->commit_fallback(external, cmu);
+
+            // Only disable the cmu when something needs to be programmed
+            bool is_disabled = false;
+            auto write = [&](std::uint32_t off, std::uint32_t val) {
+                if (!std::exchange(is_disabled, true))
+                    this->regs.write(external, DC_DISP_DISP_COLOR_CONTROL, control & ~CMU_ENABLE);
+                this->regs.write(external, off, val), ++this->nb_register_writes;
+            };
+
+            for (std::size_t i = 0; i < shadow.csc.size(); ++i) {
+                auto val = static_cast<std::uint16_t>((&cmu.krr)[i]) & QS18::BitMask;
+                if (shadow.csc[i] != val)
+                    write(DC_COM_CMU_CSC_KRR + i * sizeof(std::uint32_t), val);
+            }
+
+            for (std::size_t i = 0; i < shadow.lut_1.size(); ++i) {
+                if (shadow.lut_1[i] != cmu.lut_1[i])
+                    write(DC_COM_CMU_LUT1, LUT1_ADDR(i) | LUT1_DATA(cmu.lut_1[i]));
+            }
+
+            for (std::size_t i = 0; i < shadow.lut_2.size(); ++i) {
+                if (shadow.lut_2[i] != cmu.lut_2[i])
+                    write(DC_COM_CMU_LUT2, LUT2_ADDR(i) | LUT2_DATA(cmu.lut_2[i]));
+            }
+
+            if (!is_disabled)
+                return 0;
+
+            this->regs.write(external, DC_CMD_STATE_CONTROL, GENERAL_UPDATE);
+            this->regs.write(external, DC_CMD_STATE_CONTROL, GENERAL_ACT_REQ);
+            bool is_latched = this->regs.wait_latch(external);
+
+            this->regs.write(external, DC_DISP_DISP_COLOR_CONTROL, control);
+            this->regs.write(external, DC_CMD_STATE_CONTROL, GENERAL_UPDATE);
+            this->regs.write(external, DC_CMD_STATE_CONTROL, GENERAL_ACT_REQ);
+
+            // The programmed state can't be trusted, commit it in full
+            if (!is_latched)
+                return this->commit_fallback(external, cmu);
+
+            this->save(shadow, cmu);
+            return 0;
+        }
+
+        void invalidate(bool external) override {
+            this->shadows[external].is_valid = false;
+        }
+
+        std::uint32_t get_nb_register_writes() const {
+            return this->nb_register_writes;
+        }
+
+    private:
+        Result commit_fallback(bool external, Cmu &cmu) {
+            auto &shadow = this->shadows[external];
+
+            shadow.is_valid = false;
+            if (auto rc = this->fallback.commit(external, cmu); R_FAILED(rc))
+                return rc;
+
+            this->save(shadow, cmu);
+            return 0;
+        }
+
+        struct Shadow {
+            bool is_valid = false;
+            std::array<std::uint16_t, 9> csc = {};
+            decltype(Cmu::lut_1) lut_1 = {};
+            decltype(Cmu::lut_2) lut_2 = {};
+        };
+
+        static void save(Shadow &shadow, const Cmu &cmu) {
+            std::transform(&cmu.krr, &cmu.krr + shadow.csc.size(), shadow.csc.begin(),
+                [](QS18 c) -> std::uint16_t { return static_cast<std::uint16_t>(c) & QS18::BitMask; });
+            shadow.lut_1    = cmu.lut_1;
+            shadow.lut_2    = cmu.lut_2;
+            shadow.is_valid = cmu.enable;
+        }
+
+    private:
+        Regs &regs;
+        CmuBackend &fallback;
+
+        std::array<Shadow, 2> shadows = {};
+        std::uint32_t nb_register_writes = 0;
+};
+
+// Lerp of cmu entries in 16.16 fixed point, rounding to nearest
+struct CmuLerp {
+    constexpr static std::int32_t One = 1 << 16;
+
+    std::int32_t step;
+
+    constexpr CmuLerp(float factor): step(std::clamp(static_cast<std::int32_t>(factor * One), 0, One)) { }
+
+    constexpr std::int32_t operator()(std::int32_t a, std::int32_t b) const {
+        return (a * (One - this->step) + b * this->step + One / 2) >> 16;
+    }
+
+    // Smallest step after the given one where the lerp of a and b changes, or One + 1 if there is none.
+    // The lerp is linear in the step before rounding, so the crossing of the next integer is found directly
+    static constexpr std::int32_t next_change(std::int32_t a, std::int32_t b, std::int32_t step) {
+        std::int64_t d = b - a, base = static_cast<std::int64_t>(a) * One + One / 2;
+        if (!d)
+            return One + 1;
+
+        auto value = (base + d * step) >> 16, next = (d > 0) ?
+            ((value + 1) * One - base + d - 1) / d :  // First step reaching value + 1
+            (base - value * One) / -d + 1;            // First step falling under value
+        return static_cast<std::int32_t>(std::min<std::int64_t>(next, One + 1));
+    }
+};
+
+// LRU cache of calculated cmus, keyed by the settings quantized to the resolution of the cmu,
+// so that settings differing by less than an output step, eg. while dragging a slider, share an entry
+class CmuCache {
+    public:
+        constexpr static std::size_t Capacity = 8;
+
+        // Steps of the float settings, around their defaults which stay exact. The temperature is in whole kelvins
+        constexpr static float Resolution = 1024.0f;
+
+        using Key = std::array<std::uint32_t, 9>;
+
+    public:
+        // Settings snapped to the steps of the key, which the cmus of the cache are calculated from
+        static FizeauSettings quantize(const FizeauSettings &settings);
+
+        // Expects quantized settings
+        static Key make_key(const FizeauSettings &settings, Component components, Component filter);
+
+        // Returns nullptr on miss. Uncounted lookups, eg. for planning, leave the statistics untouched
+        Cmu *find(const Key &key, bool is_counted = true);
+
+        // Evicts the least recently used entry, and returns it to be filled by the caller
+        Cmu &insert(const Key &key);
+
+        std::uint32_t get_hits()   const { return this->hits;   }
+        std::uint32_t get_misses() const { return this->misses; }
+
+    private:
+        struct Entry {
+            Key key = {};
+            std::uint32_t hash = 0, last_use = 0;
+            bool is_valid = false;
+            Cmu cmu = {};
+        };
+
+        std::array<Entry, Capacity> entries = {};
+        std::uint32_t use_counter = 0, hits = 0, misses = 0;
+};
+
 class DisplayController {
     public:
         using Csc  = std::array<std::uint16_t, 9>;
@@ -154,8 +389,47 @@ class DisplayController {
             Csc csc;
         };
 
+        // Intermediate results of the cmu calculation, each stage only being recomputed when its inputs change
+        struct CmuStages {
+            struct {
+                bool is_valid = false;
+                Temperature temperature = 0;
+                Saturation saturation = 0;
+                Hue hue = 0;
+                Contrast contrast = 0;
+                Component components = Component_None, filter = Component_None;
+
+                std::array<QS18, 9> coeffs = {};
+            } csc;
+
+            struct {
+                bool is_valid = false;
+                Gamma gamma = 0;
+                Contrast contrast = 0;
+
+                float top = 0;
+                std::array<float, std::tuple_size_v<decltype(Cmu::lut_2)>> samples = {};
+            } regamma;
+
+            struct {
+                bool is_valid = false;
+                Luminance luminance = 0;
+                ColorRange range = {};
+
+                decltype(Cmu::lut_2) lut = {};
+                std::uint32_t hash = 0;
+            } luma_range;
+        };
+
     public:
         Result initialize() {
+            std::uint64_t size;
+            if (auto rc = svcQueryMemoryMapping(&this->registers.clock_va_base, &size, CLOCK_IO_BASE, CLOCK_IO_SIZE); R_FAILED(rc))
+                return rc;
+
+            if (auto rc = svcQueryMemoryMapping(&this->registers.disp_va_base, &size, DISP_IO_BASE, DISP_IO_SIZE); R_FAILED(rc))
+                return rc;
+
             return nvOpen(&this->disp0_fd, "/dev/nvdisp-disp0") || nvOpen(&this->disp1_fd, "/dev/nvdisp-disp1");
         }
 
@@ -163,13 +437,115 @@ class DisplayController {
             return nvClose(this->disp0_fd) || nvClose(this->disp1_fd);
         }
 
-        Result disable(bool external) const;
+        Result disable(bool external);
         Result apply_color_profile(bool external, FizeauSettings &settings,
-            Component components, Component filter, CmuShadow &shadow) const;
-        Result set_hdmi_color_range(bool external, ColorRange range) const;
+            Component components, Component filter, CmuShadow &shadow, CmuStages &stages);
+        // Same, without inserting the cmu into the cache. Previews follow a slider, so their cmus are rarely shown again
+        Result apply_uncached_color_profile(bool external, FizeauSettings &settings,
+            Component components, Component filter, CmuShadow &shadow, CmuStages &stages);
+        // Lerps the coefficients and LUT entries of the cmus of both endpoints, instead of the settings
+        Result apply_interpolated_color_profile(bool external, FizeauSettings &from, FizeauSettings &to, float factor,
+            Component components, Component filter, CmuShadow &shadow, CmuStages &stages);
+        // Calculates the cmu of the settings into the cache, ahead of its commit
+        void precompute_color_profile(const FizeauSettings &settings, Component components, Component filter, CmuStages &stages) {
+            this->get_cmu(settings, components, filter, stages);
+        }
+
+        // Commits the profile with its LUT2 faded towards the one at the dimmed luminance, by a factor in [0, 1].
+        // CSC and LUT1 are those of the undimmed profile, so they are left untouched
+        Result apply_dimming_step(bool external, FizeauSettings &settings, Luminance luma, float factor,
+            Component components, Component filter, CmuShadow &shadow, CmuStages &stages);
+        // Same for a fade overlapping a cmu transition: LUT2 is faded between the interpolated cmus of the undimmed and
+        // dimmed endpoints, so the four endpoints stay in the cache for the duration of the fade
+        Result apply_interpolated_dimming_step(bool external, FizeauSettings &from, FizeauSettings &to, float factor,
+            Luminance luma, float dim_level, Component components, Component filter, CmuShadow &shadow, CmuStages &stages);
+        Result set_hdmi_color_range(bool external, ColorRange range);
+
+        // Hash of the hardware-visible state committed by apply_color_profile, for a given set of parameters
+        std::uint32_t hash_color_profile(const FizeauSettings &settings,
+            Component components, Component filter, CmuStages &stages);
+
+        // Smallest step after the given one where the cmu committed by apply_interpolated_color_profile(from, to)
+        // changes, with the factor as a CmuLerp step, or CmuLerp::One + 1 if there is none.
+        // The endpoints are fetched without counting towards the cache statistics
+        std::int32_t next_interpolated_change(const FizeauSettings &from, const FizeauSettings &to, std::int32_t step,
+            Component components, Component filter, CmuStages &stages);
+
+        const CmuCache &get_cmu_cache() const {
+            return this->cmu_cache;
+        }
+
+        // Defaults to nvdrv, or to register writes when built with FZ_CMU_REGISTER_COMMITS
+        void set_cmu_backend(CmuBackend &backend) {
+            this->backend = &backend;
+        }
+
+        // Drops the knowledge of the hardware state after a likely reset, so that the next commits are issued in full
+        void invalidate_committed_state(bool external) {
+            this->backend->invalidate(external);
+            this->committed_cmus[external].is_valid = false;
+
+            // The infoframe is sent over hdmi
+            if (external)
+                this->is_rgb_quant_valid = false;
+        }
+
+        const FizeauCommitStats &get_commit_stats() const {
+            return this->commit_stats;
+        }
+
+        // Whether the display controller is clocked, register accesses to a gated controller hang the bus
+        bool is_clocked(bool external) const {
+            return this->registers.is_accessible(external);
+        }
+
+        // Io mappings of the display and clock registers, shared with the watchdog
+        const MmioRegisterFile &get_registers() const {
+            return this->registers;
+        }
 
     private:
-        std::uint32_t disp0_fd, disp1_fd;
+        Cmu *get_cmu(const FizeauSettings &settings, Component components, Component filter, CmuStages &stages,
+            bool is_counted = true);
+        Result submit_cmu(bool external, Cmu &cmu);
+        Result commit_cmu(bool external, Cmu &cmu, CmuShadow &shadow);
+        Result set_rgb_quant(RgbQuantRange rgb_quant);
+
+        // Failed ioctls are reported through the commit statistics, since commits on deadlines have no caller to return to
+        Result record_failure(Result rc) {
+            ++this->commit_stats.nb_failed;
+            this->commit_stats.last_error = rc;
+            return rc;
+        }
+
+    private:
+        std::uint32_t disp0_fd = 0, disp1_fd = 0;
+
+        MmioRegisterFile registers = {};
+        NvdrvCmuBackend nvdrv_backend = { this->disp0_fd, this->disp1_fd };
+        RegisterCmuBackend<MmioRegisterFile> register_backend = { this->registers, this->nvdrv_backend };
+#ifdef FZ_CMU_REGISTER_COMMITS
+        CmuBackend *backend = &this->register_backend;
+#else
+        CmuBackend *backend = &this->nvdrv_backend;
+#endif
+
+        CmuCache cmu_cache = {};
+
+        // Cmus not held by the cache (interpolated or disabled) are built in place here, instead of on thread stacks
+        Cmu scratch_cmu = {};
+
+        // Last committed state, per display
+        struct CommittedCmu {
+            bool is_valid = false;
+            std::uint32_t hash = 0;
+        };
+
+        std::array<CommittedCmu, 2> committed_cmus = {};
+        bool is_rgb_quant_valid = false;
+        RgbQuantRange committed_rgb_quant = RgbQuantRange::Default;
+
+        FizeauCommitStats commit_stats = {};
 };
 
 } // namespace fz
@@ -16,7 +16,10 @@
 // along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 #include <chrono>
+#include <utility>
 #include <switch.h>
 
 #include <common.hpp>
@@ -35,167 +38,741 @@ namespace {
 
 constexpr std::uint32_t ins_evt_id = 0;
 
-FizeauSettings interpolate_profile(FizeauProfile &in, float factor, bool from_day) {
-    FizeauSettings out,
-        &from =  from_day ? in.day_settings : in.night_settings,
-        &to   = !from_day ? in.day_settings : in.night_settings;
-
-    out = {
-        .temperature     = static_cast<Temperature>(std::lerp(from.temperature, to.temperature, factor)),
-        .saturation      = std::lerp(from.saturation, to.saturation, factor),
-        .hue             = std::lerp(from.hue,        to.hue,        factor),
-        .contrast        = std::lerp(from.contrast,   to.contrast,   factor),
-        .gamma           = std::lerp(from.gamma,      to.gamma,      factor),
-        .luminance       = std::lerp(from.luminance,  to.luminance,  factor),
-        .range           = {
-                           std::lerp(from.range.lo,   to.range.lo,   factor),
-                           std::lerp(from.range.hi,   to.range.hi,   factor),
-        },
-    };
+// Fields feeding the computation of the cmu, those holding the settings of the keyframes, and those placing them in time
+constexpr std::uint32_t cmu_fields = FizeauProfileField_Components | FizeauProfileField_Filter | FizeauProfileField_TransitionMode,
+    settings_fields = FizeauProfileField_DaySettings | FizeauProfileField_NightSettings | FizeauProfileField_Keyframes,
+    schedule_fields = settings_fields | FizeauProfileField_Schedule;
 
-    return out;
-}
+// Inputs of the cmu shown for a sample, the endpoints only matter when the cmus are interpolated directly
+struct ShownSettings {
+    FizeauSettings settings = {}, from = {}, to = {};
+    float factor = 0.0f;
+
+    static ShownSettings from_sample(const Schedule::Sample &sample, FizeauTransitionMode mode) {
+        if (sample.from && (mode == FizeauTransitionMode_Cmu))
+            return { sample.settings, *sample.from, *sample.to, sample.factor };
+        return { sample.settings };
+    }
+
+    bool operator ==(const ShownSettings &other) const {
+        return (this->settings == other.settings) && (this->from == other.from) && (this->to == other.to) &&
+            (this->factor == other.factor);
+    }
+};
 
 } // namespace
 
-void ProfileManager::transition_thread_func(void *args) {
-    auto *self = static_cast<ProfileManager *>(args);
+bool TransitionPlan::has_change(Timestamp lo, Timestamp hi) const {
+    if ((hi < this->start) || (lo > this->end))
+        return false;
 
-    UTimer timer;
-    utimerCreate(&timer, std::chrono::nanoseconds(100ms).count(), TimerType_Repeating);
-    utimerStart(&timer);
+    if (this->is_overflowed)
+        return true;
+
+    auto first = this->changes.begin(), last = this->changes.begin() + this->nb_changes;
+    auto it = std::lower_bound(first, last, (lo > this->start) ? lo - this->start : 0);
+    return (it != last) && (*it <= hi - this->start);
+}
 
-    while (true) {
-        int idx;
-        auto rc = waitMulti(&idx, UINT64_MAX,
-            waiterForUTimer(&timer),
-            waiterForUEvent(&self->thread_exit_event));
-        if (R_FAILED(rc))
-            return;
+void TransitionPlan::rebase(Timestamp ts) {
+    if (ts <= this->start)
+        return;
+
+    auto offset = ts - this->start;
+    auto first = this->changes.begin(), last = this->changes.begin() + this->nb_changes;
+    auto it = std::lower_bound(first, last, offset);
+
+    this->nb_changes = std::transform(it, last, first, [offset](std::uint16_t c) { return c - offset; }) - first;
+    this->start = ts;
+}
+
+void ProfileManager::extend_transition_plan(TransitionPlan &plan, bool external, Timestamp until) {
+    constexpr Timestamp day = 24*60*60;
+
+    auto &profile  = this->snapshot.profiles[plan.profile_id];
+    auto &schedule = this->schedules[plan.profile_id];
+    auto &stages   = !external ? this->context.cmu_stages_internal : this->context.cmu_stages_external;
+
+    auto dim = [&plan, luma = !external ? dimmed_luma_internal : dimmed_luma_external](FizeauSettings settings) {
+        if (plan.is_dimmed)
+            settings.luminance = luma;
+        return settings;
+    };
 
-        switch (idx) {
-            case 0:
+    auto record = [&plan](Timestamp ts) {
+        if ((ts - plan.start > UINT16_MAX) || (plan.nb_changes >= plan.changes.size())) {
+            plan.is_overflowed = true;
+            return false;
+        }
+
+        plan.changes[plan.nb_changes++] = ts - plan.start;
+        return true;
+    };
+
+    // Seconds in [start, frontier) are planned, the state of the cmu before start is taken from the previous second
+    auto prev = (plan.start + day - 1) % day;
+    bool is_new = plan.frontier == plan.start;
+
+    if (profile.transition_mode == FizeauTransitionMode_Cmu) {
+        // The cmu is a lerp between those of the keyframes of the window, whose step increases with time.
+        // From the endpoint cmus, the next step where an entry changes is known, and then the second where it is reached
+        auto ref = schedule.sample((plan.end + day - 1) % day);
+        auto from = dim(*ref.to), to = dim(*ref.from);
+
+        auto step_at = [&](Timestamp ts) {
+            auto sample = schedule.sample(ts);
+            if (sample.segment != ref.segment)
+                return (ts == plan.end) ? CmuLerp::One : 0;
+            return CmuLerp::One - CmuLerp(sample.factor).step;
+        };
+
+        if (is_new)
+            plan.step = step_at(prev);
+
+        while (plan.frontier <= until) {
+            auto next = this->disp.next_interpolated_change(from, to, plan.step, profile.components, profile.filter, stages);
+            if (next > CmuLerp::One)
+                break;
+
+            // First second reaching the step
+            auto lo = plan.frontier, hi = until + 1;
+            while (lo < hi) {
+                auto mid = lo + (hi - lo) / 2;
+                if (step_at(mid) >= next)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+
+            if (lo > until)
                 break;
-            case 1:
-            default:
+
+            if (!record(lo))
+                return;
+
+            plan.step = step_at(lo), plan.frontier = lo + 1;
+        }
+    } else {
+        // The settings are recomputed each second, skipping those where they hold
+        auto settings_at = [&](Timestamp ts) { return dim(schedule.sample(ts).settings); };
+        auto hash_at = [&](const FizeauSettings &settings) {
+            return this->disp.hash_color_profile(settings, profile.components, profile.filter, stages);
+        };
+
+        auto last = settings_at(is_new ? prev : plan.frontier - 1);
+        if (is_new)
+            plan.hash = hash_at(last);
+
+        for (; plan.frontier <= until; ++plan.frontier) {
+            auto settings = settings_at(plan.frontier);
+            if (settings == std::exchange(last, settings))
+                continue;
+
+            auto hash = hash_at(settings);
+            if (hash == std::exchange(plan.hash, hash))
+                continue;
+
+            if (!record(plan.frontier))
                 return;
         }
+    }
+
+    plan.frontier = until + 1;
+}
+
+Timestamp next_transition_event(std::span<const Schedule::Window> windows, std::span<const TransitionPlan * const> plans, Timestamp ts) {
+    constexpr Timestamp day = 24*60*60;
 
-        if (!self->context.is_active)
+    // Boundaries are taken strictly after ts, possibly on the next day
+    auto until = [ts](Timestamp t) { return (t > ts) ? t - ts : t + day - ts; };
+
+    Timestamp delay = day;
+    for (std::size_t i = 0; i < windows.size(); ++i) {
+        auto [begin, end] = windows[i];
+        delay = std::min({ delay, until(begin), until(end) });
+
+        if (!Clock::is_in_interval(ts, begin, end))
             continue;
 
-        bool need_apply = false, is_handheld = self->operation_mode == OmmOperationMode_Handheld;
+        // Without a plan covering the next second, check every second
+        auto *plan = plans[i];
+        if (!plan || plan->is_overflowed || (ts + 1 < plan->start) || (plan->frontier <= ts + 1))
+            return 1;
+
+        // Wake up at the next change, or at the frontier to extend the plan
+        auto first = plan->changes.begin(), last = plan->changes.begin() + plan->nb_changes;
+        if (auto it = (ts >= plan->start) ? std::upper_bound(first, last, ts - plan->start) : first; it != last)
+            delay = std::min(delay, plan->start + *it - ts);
+        else if (plan->frontier <= plan->end)
+            delay = std::min(delay, plan->frontier - ts);
+    }
 
-        // CMU resets
-        if (!need_apply) {
-            if (!(READ(self->clock_va_base + CLK_RST_CONTROLLER_CLK_OUT_ENB_L) & (CLK_ENB_DISP1 | CLK_ENB_DISP2)) ||
-                    !mutexTryLock(&self->commit_mutex))
-                goto cmu_end;
+    return delay;
+}
 
-            FZ_SCOPEGUARD([self] { mutexUnlock(&self->commit_mutex); });
+bool is_dimming_due(Timestamp timeout, std::uint64_t idle_ns) {
+    return timeout && (idle_ns / std::chrono::nanoseconds(1s).count() > timeout);
+}
 
-            // Poll DISPLAY_A in handheld mode, DISPLAY_B in docked mode
-            std::uint64_t iobase = self->disp_va_base + (is_handheld ? 0 : 0x40000);
+std::uint64_t next_dimming_event(Timestamp timeout, std::uint64_t idle_ns, bool is_dimming) {
+    // Undimming is triggered by activity, which reschedules the timers
+    if (!timeout || is_dimming)
+        return UINT64_MAX;
 
-            auto &shadow = is_handheld ? self->context.cmu_shadow_internal : self->context.cmu_shadow_external;
-            auto &csc    = shadow.csc;
+    // The first whole second exceeding the timeout, where is_dimming_due turns true
+    auto deadline = (timeout + 1) * std::chrono::nanoseconds(1s).count();
+    return (idle_ns < deadline) ? deadline - idle_ns : 0;
+}
 
-            // There is a race when waking from reset, where the configuration
-            // sometimes gets applied before nvdrv internally disables the CMU
-            if (!(READ(iobase + DC_DISP_DISP_COLOR_CONTROL) & CMU_ENABLE)) {
-                need_apply = true;
-                goto cmu_end;
-            }
+float DimmingFade::get_level(std::uint64_t now) const {
+    auto target = this->is_dimmed ? 1.0f : 0.0f;
+    auto elapsed = now - this->start;
+    if (elapsed >= dimming_fade_ns)
+        return target;
 
-            for (std::size_t i = 0; i < csc.size(); ++i) {
-                if (csc[i] != READ(iobase + DC_COM_CMU_CSC_KRR + i * sizeof(std::uint32_t))) {
-                    need_apply = true;
-                    goto cmu_end;
-                }
-            }
+    return std::lerp(this->from, target, static_cast<float>(elapsed) / static_cast<float>(dimming_fade_ns));
+}
+
+void DimmingFade::set_dimmed(bool is_dimmed, std::uint64_t now) {
+    if (is_dimmed == this->is_dimmed)
+        return;
+
+    this->from = this->get_level(now), this->start = now;
+    this->is_dimmed = is_dimmed;
+}
+
+bool ProfileManager::is_plan_valid(const TransitionPlan &plan, FizeauProfileId profile_id, Timestamp start, Timestamp end,
+        bool is_dimmed) const {
+    return plan.is_valid && (plan.profile_id == profile_id) && (plan.generation == this->profile_generations[profile_id]) &&
+        (plan.start <= start) && (plan.end == end) && (plan.is_dimmed == is_dimmed);
+}
+
+bool ProfileManager::check_transitions(FizeauProfileId profile_id, bool external, Timestamp lo, Timestamp hi) {
+    auto windows = this->schedules[profile_id].get_windows();
+    bool is_dimmed = this->dimming_fades[external].is_dimmed;
+
+    bool has_change = false;
+    for (std::size_t i = 0; i < windows.size(); ++i) {
+        // Include the end of the window, where the final settings get committed
+        auto [begin, end] = windows[i];
+        if ((hi < begin) || (lo > end))
+            continue;
+
+        // Plans only cover the window from the time they were started, to avoid walking it needlessly
+        auto &plan = this->transition_plans[external * Schedule::MaxWindows + i];
+        auto start = std::max(begin, lo);
+        if (!this->is_plan_valid(plan, profile_id, start, end, is_dimmed) || (plan.frontier < start)) {
+            // Seconds skipped since the frontier (eg. after the clock jumped) may hold changes
+            has_change |= plan.is_valid && (plan.profile_id == profile_id) && (plan.frontier < start);
+
+            plan = {
+                .is_valid   = true,
+                .is_dimmed  = is_dimmed,
+                .profile_id = profile_id,
+                .generation = this->profile_generations[profile_id],
+                .start      = start,
+                .end        = end,
+                .frontier   = start,
+            };
         }
 
-cmu_end:
-        auto profile_id = is_handheld ? self->context.internal_profile : self->context.external_profile;
-        if (profile_id >= FizeauProfileId_Total)
+        // Planning is bounded per wakeup, the reactor wakes up at the frontier to continue
+        this->extend_transition_plan(plan, external, std::min(end, hi + TransitionPlan::Lookahead));
+        has_change |= plan.has_change(lo, hi);
+
+        // The changes checked are dropped, which keeps the plan small
+        plan.rebase(std::min(hi + 1, end));
+    }
+
+    return has_change;
+}
+
+bool ProfileManager::check_cmu_reset(bool is_handheld, std::uint64_t now) {
+    // The registers were mapped by the display controller
+    auto &regs = this->disp.get_registers();
+
+    // Clock gated displays can't be checked, and can't show a wrong cmu either
+    if (!regs.is_accessible(!is_handheld)) {
+        this->is_display_gated = true;
+        this->watchdog.skip(now);
+        return false;
+    }
+
+    // The registers were likely reprogrammed by nvdrv when the controller got powered back
+    if (std::exchange(this->is_display_gated, false)) {
+        this->watchdog.arm(now);
+        this->disp.invalidate_committed_state(false);
+        this->disp.invalidate_committed_state(true);
+        this->mark_dirty(false);
+        this->mark_dirty(true);
+    }
+
+    // Poll DISPLAY_A in handheld mode, DISPLAY_B in docked mode
+    auto &shadow = is_handheld ? this->context.cmu_shadow_internal : this->context.cmu_shadow_external;
+    auto &csc    = shadow.csc;
+
+    auto is_reset = [&] {
+        // There is a race when waking from reset, where the configuration
+        // sometimes gets applied before nvdrv internally disables the CMU
+        if (!(regs.read(!is_handheld, DC_DISP_DISP_COLOR_CONTROL) & CMU_ENABLE))
+            return true;
+
+        auto check_register = [&](std::size_t i) {
+            return csc[i] != regs.read(!is_handheld, DC_COM_CMU_CSC_KRR + i * sizeof(std::uint32_t));
+        };
+
+        if (!this->watchdog.is_full_check(now))
+            return check_register(this->watchdog.next_register());
+
+        for (std::size_t i = 0; i < csc.size(); ++i) {
+            if (check_register(i))
+                return true;
+        }
+
+        return false;
+    }();
+
+    this->watchdog.report(now, is_reset);
+    if (is_reset) {
+        this->disp.invalidate_committed_state(!is_handheld);
+        LOG("Cmu reset detected (%u resets, max latency %luus)\n",
+            this->watchdog.get_stats().nb_resets, this->watchdog.get_stats().max_latency_us);
+    }
+
+    return is_reset;
+}
+
+void ProfileManager::request_commit() {
+    // Not pushed back by later requests, which bounds the latency of the first one
+    if (!std::exchange(this->is_commit_requested, true))
+        this->commit_deadline = armGetSystemTick() + armNsToTicks(commit_window_ns);
+}
+
+Result ProfileManager::wait_for_commit() {
+    // Commits are done on the thread of the server, so the window can be closed right away
+    if (this->is_commit_requested) {
+        this->commit_deadline = 0;
+        this->process_timers();
+    }
+
+    return this->last_commit_rc;
+}
+
+Result ProfileManager::set_preview(const FizeauSettings &settings, std::uint64_t timeout_ns, std::uint64_t receive_tick) {
+    auto &shared = this->context.shared.peek();
+    bool external = this->operation_mode != OmmOperationMode_Handheld;
+    auto profile_id = !external ? shared.internal_profile : shared.external_profile;
+    if (!shared.is_active || (profile_id >= FizeauProfileId_Total) || (external && !this->is_external_ready()))
+        return 0;
+
+    // Straight to the cmu, the schedule and dimming are left to the revert
+    auto &profile = shared.profiles[profile_id];
+    auto &shadow  = !external ? this->context.cmu_shadow_internal : this->context.cmu_shadow_external;
+    auto &stages  = !external ? this->context.cmu_stages_internal : this->context.cmu_stages_external;
+
+    auto preview = settings;
+    if (auto rc = this->disp.apply_uncached_color_profile(external, preview, profile.components, profile.filter,
+            shadow, stages); R_FAILED(rc))
+        return rc;
+
+    if (auto rc = this->disp.set_hdmi_color_range(external, preview.range); R_FAILED(rc))
+        return rc;
+
+    auto now = armGetSystemTick();
+    auto latency_us = armTicksToNs(now - receive_tick) / 1000;
+    this->preview_stats.nb_previews      += 1;
+    this->preview_stats.last_latency_us   = latency_us;
+    this->preview_stats.total_latency_us += latency_us;
+    this->preview_stats.max_latency_us    = std::max(this->preview_stats.max_latency_us, latency_us);
+
+    // The other display can't be showing a preview, since they are ended on operation mode changes
+    this->previewing_displays = 1u << external;
+    this->preview_deadline    = now + armNsToTicks(timeout_ns);
+    this->is_commit_verified  = true;
+
+    return 0;
+}
+
+void ProfileManager::end_preview() {
+    // Recommitted with their scheduled state
+    this->dirty_displays |= std::exchange(this->previewing_displays, 0);
+    this->preview_deadline = UINT64_MAX;
+}
+
+void ProfileManager::process_commit_requests() {
+    if (!std::exchange(this->is_commit_requested, false))
+        return;
+
+    this->commit_deadline = UINT64_MAX;
+
+    // The latest state of the context is committed, which covers all requests made up to now
+    this->last_commit_rc = this->update_active();
+}
+
+bool ProfileManager::refresh_snapshot() {
+    // Cheap check, the copy is only taken when a writer went through
+    if (this->context.shared.get_version() == this->snapshot_version)
+        return false;
+
+    // Diffed in place against the snapshot, which holds the previous state until the copy at the end.
+    // Writers run on the reactor thread too, so the value can't change during the diff
+    auto &prev = this->snapshot;
+    auto &next = this->context.shared.peek();
+
+    // Which modified profiles show something else now
+    auto ts = Clock::get_current_timestamp();
+    std::array<std::uint32_t, FizeauProfileId_Total> changed_fields = {};
+    std::uint32_t shown_changes = 0;
+
+    for (std::size_t i = 0; i < this->schedules.size(); ++i) {
+        auto fields = std::exchange(this->modified_fields[i], 0);
+        if (!std::memcmp(&prev.profiles[i], &next.profiles[i], sizeof(FizeauProfile)))
             continue;
 
-        auto &profile = self->context.profiles      [profile_id];
-        auto &state   = self->context.profile_states[profile_id];
-
-        // Period transitions
-        if (!need_apply) {
-            auto dub = to_timestamp(profile.dusk_begin), due = to_timestamp(profile.dusk_end),
-                 dab = to_timestamp(profile.dawn_begin), dae = to_timestamp(profile.dawn_end);
-
-            auto ts = Clock::get_current_timestamp();
-            if (ts >= due)
-                need_apply = state == FizeauProfileState::Day;
-            else if (ts >= dub)
-                need_apply = true;
-            else if (ts >= dae)
-                need_apply = state == FizeauProfileState::Night;
-            else if (ts >= dab)
-                need_apply = true;
-
-            // Increase next timeout to avoid calculating/applying the coefficients too frequently
-            if (need_apply)
-                timer.next_tick += armNsToTicks(std::chrono::nanoseconds(1s).count());
+        // Profiles written without a mask, eg. from the configuration, are taken as modified entirely
+        changed_fields[i] = fields ? fields : static_cast<std::uint32_t>(FizeauProfileField_All);
+
+        if (changed_fields[i] & (schedule_fields | cmu_fields))
+            ++this->profile_generations[i];
+
+        if (changed_fields[i] & schedule_fields) {
+            auto prev_shown = ShownSettings::from_sample(this->schedules[i].sample(ts), prev.profiles[i].transition_mode);
+            this->schedules[i].set(next.profiles[i]);
+            if (!(ShownSettings::from_sample(this->schedules[i].sample(ts), next.profiles[i].transition_mode) == prev_shown))
+                shown_changes |= 1u << i;
         }
+    }
 
-        // Dimming
-        if (!need_apply) {
-            std::uint64_t timeout = to_timestamp(profile.dimming_timeout),
-                delta = armTicksToNs(armGetSystemTick() - self->activity_tick) / std::chrono::nanoseconds(1s).count();
+    for (bool external: { false, true }) {
+        auto prev_id = !external ? prev.internal_profile : prev.external_profile,
+            id = !external ? next.internal_profile : next.external_profile;
 
-            if (
-                (!self->is_dimming && delta >  timeout) ||
-                ( self->is_dimming && delta <= timeout)
-            )
-                need_apply = true;
+        bool is_dirty = (prev.is_active != next.is_active) || (prev_id != id), is_precomputed = is_dirty;
+        if (!is_dirty && (id < FizeauProfileId_Total) && changed_fields[id]) {
+            // eg. modifying the night settings during the day, or the dimming timeout, commits nothing
+            auto fields = changed_fields[id];
+            is_dirty = (fields & cmu_fields) || ((fields & schedule_fields) && (shown_changes & (1u << id)));
+
+            // Keyframes shown later still get cached
+            is_precomputed = fields & (settings_fields | FizeauProfileField_Components | FizeauProfileField_Filter);
         }
 
-        if (need_apply)
-            self->apply();
+        if (is_dirty)
+            this->mark_dirty(external);
+
+        // Each modification pushes the deadline back
+        if (is_precomputed) {
+            this->precomputing_displays |= 1u << external;
+            this->precompute_deadline    = armGetSystemTick() + armNsToTicks(precompute_delay_ns);
+        }
     }
+
+    this->snapshot_version = this->context.shared.read(this->snapshot);
+
+    this->notify_state_change();
+    return true;
 }
 
-void ProfileManager::event_monitor_thread_func(void *args) {
-    auto *self = static_cast<ProfileManager *>(args);
+void ProfileManager::precompute_keyframes(bool external) {
+    auto profile_id = !external ? this->snapshot.internal_profile : this->snapshot.external_profile;
+    if (!this->snapshot.is_active || (profile_id >= FizeauProfileId_Total) || (external && !this->is_external_ready()))
+        return;
 
-    while (true) {
-        int idx;
-        auto rc = waitMulti(&idx, UINT64_MAX,
-            waiterForEvent(&self->operation_mode_event),
-            waiterForEvent(&self->activity_event),
-            waiterForUEvent(&self->thread_exit_event));
-        if (R_FAILED(rc))
-            return;
+    auto &profile = this->snapshot.profiles[profile_id];
+    auto &stages  = !external ? this->context.cmu_stages_internal : this->context.cmu_stages_external;
 
-        switch (idx) {
-            case 0: {
-                ommGetOperationMode(&self->operation_mode);
-                break;
-            }
-            case 1: {
-                insrGetLastTick(ins_evt_id, &self->activity_tick);
-                break;
-            }
-            case 2:
-            default:
-                return;
+    for (auto &keyframe: this->schedules[profile_id].get_keyframes())
+        this->disp.precompute_color_profile(keyframe.settings, profile.components, profile.filter, stages);
+}
+
+bool ProfileManager::is_external_ready() const {
+    return !this->context.is_lite && (this->operation_mode != OmmOperationMode_Handheld) && this->disp.is_clocked(true);
+}
+
+bool ProfileManager::has_pending_commits() const {
+    auto dirty = this->dirty_displays & ~this->previewing_displays;
+    if (!this->is_external_ready())
+        dirty &= ~(1u << true);
+    return dirty;
+}
+
+void ProfileManager::query_activity() {
+    if (std::uint64_t tick; R_SUCCEEDED(insrGetLastTick(ins_evt_id, &tick)))
+        this->activity_tick = tick;
+
+    ++this->wakeup_stats.nb_activity_queries;
+}
+
+std::uint64_t ProfileManager::get_idle_ns(std::uint64_t now) const {
+    return (now > this->activity_tick) ? armTicksToNs(now - this->activity_tick) : 0;
+}
+
+void ProfileManager::notify_state_change() {
+    ++this->state_generation;
+    for (auto &state_event: this->state_events) {
+        if (state_event.session != INVALID_HANDLE)
+            eventFire(&state_event.event);
+    }
+}
+
+Result ProfileManager::get_state_event(Handle session, Handle &out) {
+    auto it = std::find_if(this->state_events.begin(), this->state_events.end(),
+        [session](const StateEvent &state_event) { return state_event.session == session; });
+
+    if (it == this->state_events.end()) {
+        it = std::find_if(this->state_events.begin(), this->state_events.end(),
+            [](const StateEvent &state_event) { return state_event.session == INVALID_HANDLE; });
+        if (it == this->state_events.end())
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+        if (auto rc = eventCreate(&it->event, false); R_FAILED(rc))
+            return rc;
+        it->session = session;
+    }
+
+    out = it->event.revent;
+    return 0;
+}
+
+void ProfileManager::release_state_event(Handle session) {
+    for (auto &state_event: this->state_events) {
+        if ((session != INVALID_HANDLE) && (state_event.session == session)) {
+            eventClose(&state_event.event);
+            state_event = {};
         }
     }
 }
 
-Result ProfileManager::initialize() {
-    std::uint64_t size;
-    if (auto rc = svcQueryMemoryMapping(&this->clock_va_base, &size, CLOCK_IO_BASE, CLOCK_IO_SIZE); R_FAILED(rc))
-        diagAbortWithResult(rc);
+void ProfileManager::process_timers() {
+    ++this->wakeup_stats.nb_transition_wakeups;
 
-    if (auto rc = svcQueryMemoryMapping(&this->disp_va_base, &size, DISP_IO_BASE, DISP_IO_SIZE); R_FAILED(rc))
-        diagAbortWithResult(rc);
+    // Reevaluate everything when rescheduled, since the profiles or the operation mode may have changed.
+    // Closing the commit window counts as one
+    bool is_woken = std::exchange(this->is_rescheduled, false) || (armGetSystemTick() >= this->commit_deadline);
+
+    // A modified context is handled like an explicit reschedule
+    is_woken |= this->refresh_snapshot();
+
+    // While undimmed, the last input tick is only needed when a commit may dim the screen
+    bool is_activity_queried = !this->is_dimming && (is_woken || (armGetSystemTick() >= this->dimming_deadline));
+    if (is_activity_queried)
+        this->query_activity();
+
+    // The revert is committed along with the other pending work
+    if (armGetSystemTick() >= this->preview_deadline) {
+        ++this->preview_stats.nb_timeouts;
+        this->end_preview();
+    }
+
+    if (is_woken)
+        this->process_commit_requests();
+
+    if (armGetSystemTick() >= this->precompute_deadline) {
+        for (bool external: { false, true }) {
+            if (this->precomputing_displays & (1u << external))
+                this->precompute_keyframes(external);
+        }
+
+        this->precomputing_displays = 0;
+        this->precompute_deadline   = UINT64_MAX;
+    }
+
+    if (!this->snapshot.is_active)
+        return;
+
+    auto now = armGetSystemTick();
+    bool need_apply = false, is_handheld = this->operation_mode == OmmOperationMode_Handheld;
+
+    // CMU resets
+    if (std::exchange(this->is_watchdog_armed, false))
+        this->watchdog.arm(armTicksToNs(now));
+    if (std::exchange(this->is_commit_verified, false))
+        this->watchdog.verify(armTicksToNs(now));
+
+    if (is_woken || (now >= this->cmu_check_deadline))
+        need_apply = this->check_cmu_reset(is_handheld, armTicksToNs(now));
+    this->cmu_check_deadline = armNsToTicks(this->watchdog.get_deadline());
+
+    auto profile_id = is_handheld ? this->snapshot.internal_profile : this->snapshot.external_profile;
+    if (profile_id >= FizeauProfileId_Total) {
+        this->transition_deadline = this->dimming_deadline = UINT64_MAX;
+        return;
+    }
+
+    auto &profile  = this->snapshot.profiles       [profile_id];
+    auto &segment  = this->context.profile_segments[profile_id];
+    auto &schedule = this->schedules[profile_id];
+
+    // Period transitions, evaluated once for every second elapsed since the last check.
+    // Within transition windows, only the timestamps where the committed cmu changes trigger a commit
+    if (is_woken || (now >= this->transition_deadline)) {
+        auto ts = Clock::get_current_timestamp();
+        if (ts != this->last_transition_check) {
+            // Wrap around midnight
+            auto lo = (ts > this->last_transition_check) ? this->last_transition_check + 1 : 0;
+            this->last_transition_check = ts;
+
+            bool has_change = this->check_transitions(profile_id, !is_handheld, lo, ts);
+
+            // Catches segment boundaries crossed while no commit was planned, eg. after the clock jumped
+            if (!need_apply)
+                need_apply = (schedule.sample(ts).segment != segment) || has_change;
+        }
+
+        // Also evaluated on reschedules, which may have switched the current profile
+        if (auto period = schedule.get_period(schedule.sample(ts)).first; std::exchange(this->current_period, period) != period)
+            this->notify_state_change();
+
+        auto windows = schedule.get_windows();
+        std::array<const TransitionPlan *, Schedule::MaxWindows> plans = {};
+        for (std::size_t i = 0; i < windows.size(); ++i) {
+            auto &plan = this->transition_plans[!is_handheld * Schedule::MaxWindows + i];
+            if (this->is_plan_valid(plan, profile_id, std::max(windows[i].first, ts + 1), windows[i].second,
+                    this->dimming_fades[!is_handheld].is_dimmed))
+                plans[i] = &plan;
+        }
+
+        // Wake up at the start of the second of the next event, period changes are waited on even when the settings hold
+        auto delay = std::min(next_transition_event(windows, std::span(plans).first(windows.size()), ts),
+            schedule.next_keyframe(ts)) * std::chrono::nanoseconds(1s).count();
+        this->transition_deadline = now + armNsToTicks(delay - Clock::get_current_second_offset());
+    }
+
+    auto timeout_s = to_timestamp(profile.dimming_timeout);
+
+    // Dimming
+    if (!need_apply && (is_woken || (now >= this->dimming_deadline)))
+        need_apply = is_dimming_due(timeout_s, this->get_idle_ns(now)) != this->is_dimming;
+
+    // Dimming fades are stepped once per frame
+    if (now >= this->fade_deadline)
+        this->dirty_displays |= std::exchange(this->fading_displays, 0);
+
+    // Also picks up deferred external work, once the display got clocked
+    if (need_apply)
+        this->mark_dirty(!is_handheld);
+
+    // Also returned by the next WaitForCommit. Commits reevaluate dimming, which must not see a stale input tick,
+    // eg. when a transition step lands after the timeout of the last query but before its deadline
+    if (this->has_pending_commits()) {
+        if (!this->is_dimming && !is_activity_queried)
+            this->query_activity();
+        this->last_commit_rc = this->apply();
+    }
+
+    if (std::exchange(this->is_watchdog_armed, false))
+        this->watchdog.arm(armTicksToNs(now));
+    if (std::exchange(this->is_commit_verified, false))
+        this->watchdog.verify(armTicksToNs(now));
+    this->cmu_check_deadline = armNsToTicks(this->watchdog.get_deadline());
+
+    this->fade_deadline = this->fading_displays ? now + armNsToTicks(dimming_fade_step_ns) : UINT64_MAX;
+
+    // Computed after committing, which updates the dimming state
+    if (auto delay = next_dimming_event(timeout_s, this->get_idle_ns(now), this->is_dimming); delay != UINT64_MAX)
+        this->dimming_deadline = now + armNsToTicks(delay);
+    else
+        this->dimming_deadline = UINT64_MAX;
+
+    // Input events come at controller rate during gameplay, so they are only waited on while dimmed,
+    // where undimming needs to react to them immediately
+    if (!std::exchange(this->is_activity_armed, this->is_dimming) && this->is_dimming) {
+        // Drop the events signaled while not armed, and catch up with input since the dimming decision
+        eventClear(&this->activity_event);
+
+        if (std::uint64_t tick; R_SUCCEEDED(insrGetLastTick(ins_evt_id, &tick)) && (tick != this->activity_tick)) {
+            this->activity_tick = tick;
+            this->reschedule();
+        }
+    }
+}
+
+void ProfileManager::process_operation_mode_change() {
+    eventClear(&this->operation_mode_event);
+    ommGetOperationMode(&this->operation_mode);
+
+    // The preview was for the other display
+    this->end_preview();
 
+    this->disp.invalidate_committed_state(false);
+    this->disp.invalidate_committed_state(true);
+
+    // The display being connected gets committed once it is clocked
+    this->mark_dirty(false);
+    this->mark_dirty(true);
+
+    this->is_watchdog_armed = true;
+    this->reschedule();
+
+    // The current display, and with it the current profile, changed
+    this->notify_state_change();
+}
+
+void ProfileManager::process_activity() {
+    eventClear(&this->activity_event);
+
+    if (std::uint64_t tick; R_SUCCEEDED(insrGetLastTick(ins_evt_id, &tick)))
+        this->activity_tick = tick;
+
+    ++this->wakeup_stats.nb_activity_events;
+    this->reschedule();
+}
+
+std::size_t ProfileManager::get_handles(std::span<Handle> handles) const {
+    std::size_t count = 0;
+    if (count < handles.size())
+        handles[count++] = this->operation_mode_event.revent;
+    if (this->is_activity_armed && (count < handles.size()))
+        handles[count++] = this->activity_event.revent;
+    return count;
+}
+
+std::uint64_t ProfileManager::get_deadline() const {
+    // Writes to the context are picked up right away, so that clients get notified of them,
+    // unless they come with a commit request, which are picked up together when its window closes
+    bool is_written = this->context.shared.get_version() != this->snapshot_version;
+    if (this->is_rescheduled || (is_written && !this->is_commit_requested))
+        return 0;
+
+    // Nothing else is scheduled while inactive, reactivating requests a commit
+    if (!this->snapshot.is_active)
+        return (this->commit_deadline != UINT64_MAX) ? armTicksToNs(this->commit_deadline) : UINT64_MAX;
+
+    auto deadline = std::min({ this->cmu_check_deadline, this->transition_deadline, this->dimming_deadline, this->fade_deadline,
+        this->preview_deadline, this->precompute_deadline, this->commit_deadline });
+    return (deadline != UINT64_MAX) ? armTicksToNs(deadline) : UINT64_MAX;
+}
+
+Result ProfileManager::dispatch(std::int32_t idx) {
+    switch (idx) {
+        case -1:
+            this->process_timers();
+            break;
+        case 0:
+            ++this->wakeup_stats.nb_monitor_wakeups;
+            this->process_operation_mode_change();
+            break;
+        case 1:
+            ++this->wakeup_stats.nb_monitor_wakeups;
+            this->process_activity();
+            break;
+    }
+
+    return 0;
+}
+
+std::pair<FizeauPeriod, float> ProfileManager::get_current_period() const {
+    // The schedules follow the snapshot, which catches up with writes on the next timer iteration
+    auto profile_id = (this->operation_mode == OmmOperationMode_Handheld) ?
+        this->snapshot.internal_profile : this->snapshot.external_profile;
+    if (profile_id >= FizeauProfileId_Total)
+        return { FizeauPeriod_Day, 0.0f };
+
+    auto &schedule = this->schedules[profile_id];
+    return schedule.get_period(schedule.sample(Clock::get_current_timestamp()));
+}
+
+Result ProfileManager::initialize() {
     if (auto rc = ommGetOperationModeChangeEvent(&this->operation_mode_event, false); R_FAILED(rc))
         diagAbortWithResult(rc);
 
@@ -208,115 +785,135 @@ Result ProfileManager::initialize() {
     if (auto rc = insrGetLastTick(ins_evt_id, &this->activity_tick); R_FAILED(rc))
         diagAbortWithResult(rc);
 
-    ueventCreate(&this->thread_exit_event, false);
+    for (std::size_t i = 0; i < this->schedules.size(); ++i)
+        this->schedules[i].set(this->snapshot.profiles[i]);
 
-    // The event monitor thread should have a higher priority than the transition thread to ensure it wins on mutex races
-    if (auto rc = threadCreate(&this->event_monitor_thread, &ProfileManager::event_monitor_thread_func, this,
-            this->event_monitor_thread_stack, sizeof(this->event_monitor_thread_stack), 0x3d, -2); R_FAILED(rc))
-        diagAbortWithResult(rc);
-
-    if (auto rc = threadStart(&this->event_monitor_thread); R_FAILED(rc))
-        diagAbortWithResult(rc);
-
-    if (auto rc = threadCreate(&this->transition_thread, &ProfileManager::transition_thread_func, this,
-            this->transition_thread_stack, sizeof(this->transition_thread_stack), 0x3e, -2); R_FAILED(rc))
-        diagAbortWithResult(rc);
-
-    if (auto rc = threadStart(&this->transition_thread); R_FAILED(rc))
-        diagAbortWithResult(rc);
+    this->refresh_snapshot();
+    this->last_transition_check = Clock::get_current_timestamp();
 
     return 0;
 }
 
 Result ProfileManager::finalize() {
-    ueventSignal(&this->thread_exit_event);
-
-    threadWaitForExit(&this->event_monitor_thread);
-    threadWaitForExit(&this->transition_thread);
-    threadClose(&this->event_monitor_thread);
-    threadClose(&this->transition_thread);
+    for (auto &state_event: this->state_events)
+        this->release_state_event(state_event.session);
 
+    eventClose(&this->activity_event);
     eventClose(&this->operation_mode_event);
 
     return 0;
 }
 
 Result ProfileManager::apply() {
-    if (!this->context.is_active)
+    if (!this->snapshot.is_active)
         return 0;
 
-    auto apply_profile = [this](FizeauProfileId profile_id, bool dim, bool external) -> Result {
-        auto &profile = this->context.profiles      [profile_id];
-        auto &state   = this->context.profile_states[profile_id];
+    auto apply_profile = [this](FizeauProfileId profile_id, float dim_level, bool external) -> Result {
+        auto &profile = this->snapshot.profiles     [profile_id];
+        auto &segment = this->context.profile_segments[profile_id];
 
-        FizeauSettings settings;
+        auto [settings, sample_segment, from, to, factor] = this->schedules[profile_id].sample(Clock::get_current_timestamp());
+        segment = sample_segment;
 
-        auto dub = to_timestamp(profile.dusk_begin), due = to_timestamp(profile.dusk_end),
-             dab = to_timestamp(profile.dawn_begin), dae = to_timestamp(profile.dawn_end);
+        auto dimmed_luma = !external ? dimmed_luma_internal : dimmed_luma_external;
+        if (dim_level >= 1.0f)
+            settings.luminance = dimmed_luma;
 
-        auto ts = Clock::get_current_timestamp();
-        if (Clock::is_in_interval(ts, dub, due)) {
-            float factor = static_cast<float>(due - ts) / static_cast<float>(due - dub);
-            settings = interpolate_profile(profile, factor, false);
-            state    = FizeauProfileState::Night;
-        } else if (Clock::is_in_interval(ts, dab, dae)) {
-            float factor = static_cast<float>(dae - ts) / static_cast<float>(dae - dab);
-            settings = interpolate_profile(profile, factor, true);
-            state    = FizeauProfileState::Day;
-        } else if (Clock::is_in_interval(ts, dae, dub)) {
-            settings = profile.day_settings;
-            state    = FizeauProfileState::Day;
+        auto &shadow = !external ? this->context.cmu_shadow_internal : this->context.cmu_shadow_external;
+        auto &stages = !external ? this->context.cmu_stages_internal : this->context.cmu_stages_external;
+        if (from && (profile.transition_mode == FizeauTransitionMode_Cmu)) {
+            FizeauSettings from_settings = *from, to_settings = *to;
+            if ((dim_level > 0.0f) && (dim_level < 1.0f)) {
+                if (auto rc = this->disp.apply_interpolated_dimming_step(external, from_settings, to_settings, factor,
+                        dimmed_luma, dim_level, profile.components, profile.filter, shadow, stages); R_FAILED(rc))
+                    return rc;
+            } else {
+                if (dim_level >= 1.0f)
+                    from_settings.luminance = to_settings.luminance = dimmed_luma;
+
+                if (auto rc = this->disp.apply_interpolated_color_profile(external, from_settings, to_settings, factor,
+                        profile.components, profile.filter, shadow, stages); R_FAILED(rc))
+                    return rc;
+            }
+        } else if ((dim_level > 0.0f) && (dim_level < 1.0f)) {
+            if (auto rc = this->disp.apply_dimming_step(external, settings, dimmed_luma, dim_level,
+                    profile.components, profile.filter, shadow, stages); R_FAILED(rc))
+                return rc;
         } else {
-            settings = profile.night_settings;
-            state    = FizeauProfileState::Night;
+            if (auto rc = this->disp.apply_color_profile(external, settings, profile.components, profile.filter, shadow, stages); R_FAILED(rc))
+                return rc;
         }
 
-        if (dim)
-            settings.luminance = !external ? dimmed_luma_internal : dimmed_luma_external;
-
-        auto &shadow = !external ? this->context.cmu_shadow_internal : this->context.cmu_shadow_external;
-        if (auto rc = this->disp.apply_color_profile(external, settings, profile.components, profile.filter, shadow); R_FAILED(rc))
-            return rc;
-
         if (auto rc = this->disp.set_hdmi_color_range(external, settings.range); R_FAILED(rc))
             return rc;
 
         return 0;
     };
 
-    auto should_dim = [this](auto profile_id, auto timeout) {
+    // Same decision as the timers, so that commits in between don't dim earlier
+    auto tick = armGetSystemTick(), now = armTicksToNs(tick), idle_ns = this->get_idle_ns(tick);
+    auto should_dim = [this, idle_ns](auto profile_id) {
         if (profile_id >= FizeauProfileId_Total)
             return false;
 
-        auto ts = to_timestamp(this->context.profiles[profile_id].dimming_timeout);
-        return ts && (timeout >= ts);
+        return is_dimming_due(to_timestamp(this->snapshot.profiles[profile_id].dimming_timeout), idle_ns);
+    };
+
+    std::array dims = {
+        should_dim(this->snapshot.internal_profile),
+        should_dim(this->snapshot.external_profile),
     };
 
-    auto timeout = armTicksToNs(armGetSystemTick() - this->activity_tick) / 1'000'000'000;
-    bool should_dim_internal = should_dim(this->context.internal_profile, timeout);
-    bool should_dim_external = should_dim(this->context.external_profile, timeout);
+    for (bool external: { false, true }) {
+        auto &fade = this->dimming_fades[external];
+        if (fade.is_dimmed != dims[external])
+            this->mark_dirty(external);
+
+        fade.set_dimmed(dims[external], now);
+    }
 
+    // Transitions are planned for the dimmed or undimmed cmus, so the deadlines are reevaluated
     auto is_handheld = this->operation_mode == OmmOperationMode_Handheld;
-    this->is_dimming = is_handheld ? should_dim_internal : should_dim_external;
+    if (std::exchange(this->is_dimming, dims[!is_handheld]) != dims[!is_handheld]) {
+        this->notify_state_change();
+        this->reschedule();
+    }
 
-    mutexLock(&this->commit_mutex);
-    FZ_SCOPEGUARD([this] { mutexUnlock(&this->commit_mutex); });
+    auto dirty = std::exchange(this->dirty_displays, 0);
+    if (!dirty)
+        return 0;
 
-    if (this->context.internal_profile < FizeauProfileId_Total) {
-        if (auto rc = apply_profile(this->context.internal_profile, should_dim_internal, false); R_FAILED(rc))
-            return rc;
-    }
+    for (bool external: { false, true }) {
+        auto profile_id = !external ? this->snapshot.internal_profile : this->snapshot.external_profile;
+        if (!(dirty & (1u << external)) || (profile_id >= FizeauProfileId_Total) || (external && this->context.is_lite))
+            continue;
+
+        // Deferred until the display is connected, the external cmu is otherwise recomputed for nothing.
+        // Also deferred while previewing, to the end of the preview
+        if ((external && !this->is_external_ready()) || (this->previewing_displays & (1u << external))) {
+            this->mark_dirty(external);
+            continue;
+        }
 
-    if (this->context.external_profile < FizeauProfileId_Total && !this->context.is_lite) {
-        if (auto rc = apply_profile(this->context.external_profile, should_dim_external, true); R_FAILED(rc))
+        // Watch for the commit being overwritten
+        this->is_commit_verified = true;
+
+        auto &fade = this->dimming_fades[external];
+        if (auto rc = apply_profile(profile_id, fade.get_level(now), external); R_FAILED(rc)) {
+            this->dirty_displays |= dirty;
             return rc;
+        }
+
+        // The next step is committed after a frame
+        if (!fade.is_done(now))
+            this->fading_displays |= 1u << external;
     }
 
     return 0;
 }
 
 Result ProfileManager::update_active() {
-    if (this->context.is_active) {
+    if (this->snapshot.is_active) {
         return this->apply();
     } else {
         if (auto rc = this->disp.disable(false); R_FAILED(rc))
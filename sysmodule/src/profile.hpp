@@ -19,49 +19,265 @@
 
 #include <cstdint>
 #include <array>
+#include <span>
+#include <utility>
 
 #include <common.hpp>
 
 #include "context.hpp"
 #include "nvdisp.hpp"
+#include "schedule.hpp"
+#include "watchdog.hpp"
 
 namespace fz {
 
 constexpr float dimmed_luma_internal = -0.1f, dimmed_luma_external = -0.7f; // Official values used in 6.0.0 am
 
+// Duration of dimming fades, and interval between their steps (one frame at 60Hz)
+constexpr std::uint64_t dimming_fade_ns = 300'000'000, dimming_fade_step_ns = 16'666'667;
+
+// Commit requests are held for this long after the first one, so that the setters queued meanwhile are coalesced
+constexpr std::uint64_t commit_window_ns = 4'000'000;
+
+// Keyframes are cached once modifications have settled for this long, rather than on every tick of a slider
+constexpr std::uint64_t precompute_delay_ns = 1'000'000'000;
+
+// Fade of a display between its undimmed (level 0) and dimmed (level 1) luminance
+struct DimmingFade {
+    bool is_dimmed = false;
+    float from = 0.0f;
+    std::uint64_t start = 0;
+
+    float get_level(std::uint64_t now) const;
+
+    // Starts a fade from the current level when the target changes
+    void set_dimmed(bool is_dimmed, std::uint64_t now);
+
+    bool is_done(std::uint64_t now) const {
+        return this->get_level(now) == (this->is_dimmed ? 1.0f : 0.0f);
+    }
+};
+
+// Timestamps within a transition window where the committed cmu changes, as offsets from the start of the plan.
+// Plans are extended a bounded number of seconds ahead of the current time, up to the frontier
+struct TransitionPlan {
+    // Seconds planned ahead of the current time, at most
+    constexpr static Timestamp Lookahead = 60;
+
+    bool is_valid = false, is_overflowed = false, is_dimmed = false;
+    FizeauProfileId profile_id = FizeauProfileId_Invalid;
+    std::uint32_t generation = 0;
+    Timestamp start = 0, end = 0, frontier = 0;
+
+    // State of the cmu at the frontier: hash of the settings mode, lerp step of the cmu mode
+    std::uint32_t hash = 0;
+    std::int32_t step = 0;
+
+    std::uint16_t nb_changes = 0;
+    std::array<std::uint16_t, 128> changes = {};
+
+    // Whether the cmu changes within [lo, hi]. Overflowed plans change every second
+    bool has_change(Timestamp lo, Timestamp hi) const;
+
+    // Drops the changes before ts, and moves the start of the plan there
+    void rebase(Timestamp ts);
+};
+
+// Pure scheduling functions, the reactor sleeps until the earliest of their results.
+// Seconds until the next window boundary, planned cmu change or plan frontier after ts. Plans are given for each window
+// of the schedule, and are null when not built yet
+Timestamp next_transition_event(std::span<const Schedule::Window> windows, std::span<const TransitionPlan * const> plans, Timestamp ts);
+
+// Whether the screen is dimmed after idling for idle_ns: once the idle time in whole seconds exceeds the timeout, if any
+bool is_dimming_due(Timestamp timeout, std::uint64_t idle_ns);
+
+// Nanoseconds until the dimming state changes, or UINT64_MAX if it only changes on user activity
+std::uint64_t next_dimming_event(Timestamp timeout, std::uint64_t idle_ns, bool is_dimming);
+
 class ProfileManager {
+    public:
+        // Client sessions which can hold a state event at once
+        constexpr static std::size_t MaxSessions = 2;
+
     public:
         constexpr ProfileManager(Context &context, DisplayController &disp): context(context), disp(disp) { }
 
+        // Reuses the register mappings of the display controller, which must be initialized first
         Result initialize();
         Result finalize();
 
         Result apply();
         Result update_active();
 
+        // Must be called when a profile is modified, with the fields that were (FizeauProfileField).
+        // Displays are only recommitted when the modified fields change what they show
+        void modify_fields(FizeauProfileId profile_id, std::uint32_t fields) {
+            this->modified_fields[profile_id] |= fields;
+        }
+
+        // Makes the reactor reevaluate the deadlines, after a change to the context
+        void reschedule() {
+            this->is_rescheduled = true;
+        }
+
+        // Commits the context once the commit window of the first pending request closes.
+        // Requests made until then are coalesced into a single commit of the latest state
+        void request_commit();
+
+        // Processes the pending commit request, if any, and returns the result of the last commit
+        Result wait_for_commit();
+
+        // Commits the settings to the current display immediately, with the components and filter of its profile.
+        // Commits to the display are deferred until the preview times out or is ended.
+        // receive_tick is the time the request was received, for the latency statistics
+        Result set_preview(const FizeauSettings &settings, std::uint64_t timeout_ns, std::uint64_t receive_tick);
+
+        // Reverts the previewing display to its scheduled state on the next commit
+        void end_preview();
+
+        // Reactor source, waiting on the operation mode event, and on input events while dimmed
+        std::size_t get_handles(std::span<Handle> handles) const;
+        std::uint64_t get_deadline() const;
+        Result dispatch(std::int32_t idx);
+
+        // Period of the profile shown on the current display
+        std::pair<FizeauPeriod, float> get_current_period() const;
+
+        // Readable event of a client session, signaled when the state seen by clients changes, along with the generation.
+        // Covers the context, the operation mode, the period of the current profile and dimming.
+        // Each session has its own event, created on the first request, so clients clearing theirs don't hide changes
+        // from the others
+        Result get_state_event(Handle session, Handle &out);
+
+        // Called once the session is closed
+        void release_state_event(Handle session);
+
+        std::uint32_t get_state_generation() const {
+            return this->state_generation;
+        }
+
+        bool get_is_dimming() const {
+            return this->snapshot.is_active && this->is_dimming;
+        }
+
+        const FizeauWatchdogStats &get_watchdog_stats() const {
+            return this->watchdog.get_stats();
+        }
+
+        const FizeauCommitStats &get_commit_stats() const {
+            return this->disp.get_commit_stats();
+        }
+
+        const FizeauWakeupStats &get_wakeup_stats() const {
+            return this->wakeup_stats;
+        }
+
+        const FizeauPreviewStats &get_preview_stats() const {
+            return this->preview_stats;
+        }
+
+        // The next apply recomputes and commits the profile of this display
+        void mark_dirty(bool external) {
+            this->dirty_displays |= 1u << external;
+        }
+
     private:
-        static void transition_thread_func(void *args);
-        static void event_monitor_thread_func(void *args);
+        // Handlers of the reactor: timers (deadlines or explicit reschedules), operation mode changes, input events
+        void process_timers();
+        void process_operation_mode_change();
+        void process_activity();
+
+        void extend_transition_plan(TransitionPlan &plan, bool external, Timestamp until);
+        bool is_plan_valid(const TransitionPlan &plan, FizeauProfileId profile_id, Timestamp start, Timestamp end,
+            bool is_dimmed) const;
+        bool check_transitions(FizeauProfileId profile_id, bool external, Timestamp lo, Timestamp hi);
+        bool check_cmu_reset(bool is_handheld, std::uint64_t now);
+        void process_commit_requests();
+
+        // Copies the shared context if it was modified since the last call, returns whether it was.
+        // Displays whose cmu is affected by the modified fields are marked dirty
+        bool refresh_snapshot();
+
+        // Fills the cmu cache with the keyframes of the profile shown on this display
+        void precompute_keyframes(bool external);
+
+        // Refreshes the last input tick, called when a commit may dim the screen
+        void query_activity();
+        std::uint64_t get_idle_ns(std::uint64_t now) const;
+
+        // Bumps the state generation and signals the state event
+        void notify_state_change();
+
+        // The external display is only committed to while docked and clocked
+        bool is_external_ready() const;
+        bool has_pending_commits() const;
 
     private:
         Context &context;
         DisplayController &disp;
 
-        std::uint64_t clock_va_base = 0, disp_va_base = 0;
-
-        UEvent thread_exit_event = {};
-        Thread transition_thread = {}, event_monitor_thread = {};
-        std::uint8_t transition_thread_stack[0x2000] alignas(0x1000) = {},
-            event_monitor_thread_stack[0x1000] alignas(0x1000) = {};
+        // Deadlines in system ticks, the reactor sleeps until the earliest one or until rescheduled
+        bool is_rescheduled = true;
+        std::uint64_t cmu_check_deadline = 0, transition_deadline = 0, dimming_deadline = 0, fade_deadline = UINT64_MAX;
 
         Event operation_mode_event = {};
         OmmOperationMode operation_mode = {};
 
+        // Input events are only waited on while dimmed, the last input tick is otherwise queried lazily
         Event activity_event = {};
-        std::uint64_t activity_tick = {};
-        bool is_dimming = false;
+        std::uint64_t activity_tick = 0;
+        bool is_activity_armed = false, is_dimming = false;
+
+        FizeauWakeupStats wakeup_stats = {};
+
+        // Signaled on state changes, period of the current profile at the last transition check
+        struct StateEvent {
+            Handle session = INVALID_HANDLE;
+            Event event = {};
+        };
+
+        std::array<StateEvent, MaxSessions> state_events = {};
+        std::uint32_t state_generation = 0;
+        FizeauPeriod current_period = FizeauPeriod_Day;
+
+        bool is_commit_requested = false;
+        std::uint64_t commit_deadline = UINT64_MAX;
+        Result last_commit_rc = 0;
+
+        // Applied on the next timer iteration, event handlers request bursts and commits a verification through the flags
+        CmuWatchdog watchdog = {};
+        bool is_watchdog_armed = false, is_commit_verified = false;
+        bool is_display_gated = false;
+
+        // Copy of the shared context used for commits, refreshed when a writer went through
+        ContextSnapshot snapshot = {};
+        std::uint32_t snapshot_version = 0;
+
+        // Bitmask indexed by display, both start dirty so the first apply commits everything
+        std::uint32_t dirty_displays = 0b11;
+
+        std::array<DimmingFade, 2> dimming_fades = {};
+        std::uint32_t fading_displays = 0;
+
+        // Bitmask indexed by display, with the time the preview reverts in system ticks
+        std::uint32_t previewing_displays = 0;
+        std::uint64_t preview_deadline = UINT64_MAX;
+        FizeauPreviewStats preview_stats = {};
+
+        // Keyframes of each profile, rebuilt when it gets modified
+        std::array<Schedule, FizeauProfileId_Total> schedules = {};
+
+        // Bitmask indexed by display, with the time the keyframes of its modified profile get cached in system ticks
+        std::uint32_t precomputing_displays = 0;
+        std::uint64_t precompute_deadline = UINT64_MAX;
+
+        // Fields of each profile modified since the last refresh of the snapshot
+        std::array<std::uint32_t, FizeauProfileId_Total> modified_fields = {};
 
-        Mutex commit_mutex = {};
+        // Plans of the schedule windows for the internal and external displays
+        std::array<TransitionPlan, 2 * Schedule::MaxWindows> transition_plans = {};
+        std::array<std::uint32_t, FizeauProfileId_Total> profile_generations = {};
+        Timestamp last_transition_check = 0;
 };
 
 } // namespace fz
\ No newline at end of file
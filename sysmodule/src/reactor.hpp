@@ -0,0 +1,196 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <span>
+#include <tuple>
+
+#ifdef __SWITCH__
+#   include <switch.h>
+#else
+#   include <cerrno>
+#   include <climits>
+#   include <ctime>
+#   include <poll.h>
+#endif
+
+namespace fz {
+
+#ifdef __SWITCH__
+
+// Waits on kernel synchronization objects, ie. ports, sessions and readable events
+struct HorizonWaiter {
+    using Handle = ::Handle;
+    using Result = ::Result;
+
+    constexpr static std::size_t MaxHandles = MAX_WAIT_OBJECTS;
+    constexpr static Result TimedOut = KERNELRESULT(TimedOut);
+
+    static std::uint64_t now() {
+        return armTicksToNs(armGetSystemTick());
+    }
+
+    static Result wait(std::int32_t &idx, std::span<const Handle> handles, std::uint64_t timeout_ns) {
+        return svcWaitSynchronization(&idx, handles.data(), handles.size(), timeout_ns);
+    }
+};
+
+using PlatformWaiter = HorizonWaiter;
+
+#else
+
+// Stand-in waiting on file descriptors (pipes, eventfds, sockets), to run the reactor on a host
+struct PollWaiter {
+    using Handle = int;
+    using Result = int;
+
+    constexpr static std::size_t MaxHandles = 64;
+    constexpr static Result TimedOut = ETIMEDOUT;
+
+    static std::uint64_t now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+    }
+
+    static Result wait(std::int32_t &idx, std::span<const Handle> handles, std::uint64_t timeout_ns) {
+        std::array<pollfd, MaxHandles> fds;
+        for (std::size_t i = 0; i < handles.size(); ++i)
+            fds[i] = { .fd = handles[i], .events = POLLIN, .revents = 0 };
+
+        // Interrupted waits are resumed with the remaining time, signals are not reactor events
+        auto deadline = (timeout_ns == UINT64_MAX) ? UINT64_MAX : now() + timeout_ns;
+        int rc;
+        do {
+            auto remaining = (deadline == UINT64_MAX) ? UINT64_MAX : deadline - std::min(deadline, now());
+
+            // Rounded up, so that deadlines have passed when this times out
+            auto timeout_ms = (remaining == UINT64_MAX) ? -1 :
+                static_cast<int>(std::min<std::uint64_t>((remaining + 999'999) / 1'000'000, INT_MAX));
+
+            rc = poll(fds.data(), handles.size(), timeout_ms);
+        } while ((rc < 0) && (errno == EINTR));
+
+        if (rc < 0)
+            return errno;
+        if (rc == 0)
+            return TimedOut;
+
+        // Lowest signaled index, like the kernel
+        for (std::size_t i = 0; i < handles.size(); ++i) {
+            if (fds[i].revents) {
+                idx = static_cast<std::int32_t>(i);
+                break;
+            }
+        }
+
+        return 0;
+    }
+};
+
+using PlatformWaiter = PollWaiter;
+
+#endif
+
+template <typename T, typename Waiter>
+concept ReactorSource = requires(T &source, std::span<typename Waiter::Handle> handles, std::int32_t idx) {
+    // Writes the handles to wait on, which may change between waits, and returns their number
+    { source.get_handles(handles) } -> std::same_as<std::size_t>;
+
+    // Time of the next timer of the source in ns (on the clock of the waiter), UINT64_MAX if none
+    { source.get_deadline() } -> std::same_as<std::uint64_t>;
+
+    // Called with the index of the signaled handle within those of the source, or with -1 when its deadline expired
+    { source.dispatch(idx) } -> std::same_as<typename Waiter::Result>;
+};
+
+// Single-threaded event loop, which waits on the handles of all sources and on the earliest of their deadlines at once
+template <typename Waiter, typename ...Sources> requires (ReactorSource<Sources, Waiter> && ...)
+class BasicReactor {
+    public:
+        using Handle = typename Waiter::Handle;
+        using Result = typename Waiter::Result;
+
+    public:
+        constexpr BasicReactor(Sources &...sources): sources(sources...) { }
+
+        Result run_once() {
+            std::array<Handle, Waiter::MaxHandles> handles;
+            std::array<std::size_t,   sizeof...(Sources) + 1> offsets = {};
+            std::array<std::uint64_t, sizeof...(Sources)>     deadlines = {};
+
+            std::apply([&](auto &...sources) {
+                std::size_t i = 0;
+                ((deadlines[i] = sources.get_deadline(),
+                    offsets[i + 1] = offsets[i] + sources.get_handles(std::span(handles).subspan(offsets[i])), ++i), ...);
+            }, this->sources);
+
+            auto deadline = std::ranges::min(deadlines), now = Waiter::now();
+            auto timeout = (deadline == UINT64_MAX) ? UINT64_MAX : (deadline > now) ? deadline - now : 0;
+
+            std::int32_t idx = -1;
+            auto rc = Waiter::wait(idx, std::span(handles.data(), offsets.back()), timeout);
+            if (rc == Waiter::TimedOut)
+                idx = -1;
+            else if (rc != 0)
+                return rc;
+
+            // Signaled handles are processed first, expired timers still run when handles keep being signaled
+            now = Waiter::now();
+            return std::apply([&](auto &...sources) {
+                std::size_t i = 0;
+                Result rc = 0;
+                ((rc = (rc != 0) ? rc : this->dispatch(sources, idx, offsets[i], offsets[i + 1], deadlines[i], now), ++i), ...);
+                return rc;
+            }, this->sources);
+        }
+
+        // Returns on the first error reported by a source
+        Result run() {
+            while (true) {
+                if (auto rc = this->run_once(); rc != 0)
+                    return rc;
+            }
+        }
+
+    private:
+        static Result dispatch(auto &source, std::int32_t idx, std::size_t first, std::size_t last,
+                std::uint64_t deadline, std::uint64_t now) {
+            if ((idx >= 0) && (static_cast<std::size_t>(idx) >= first) && (static_cast<std::size_t>(idx) < last)) {
+                if (auto rc = source.dispatch(static_cast<std::int32_t>(idx - first)); rc != 0)
+                    return rc;
+            }
+
+            if (deadline <= now)
+                return source.dispatch(-1);
+
+            return 0;
+        }
+
+    private:
+        std::tuple<Sources &...> sources;
+};
+
+template <typename ...Sources>
+using Reactor = BasicReactor<PlatformWaiter, Sources...>;
+
+} // namespace fz
@@ -0,0 +1,190 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <algorithm>
+
+#include "schedule.hpp"
+
+namespace fz {
+
+namespace {
+
+constexpr Timestamp day = 24*60*60;
+
+FizeauSettings interpolate_settings(const FizeauSettings &from, const FizeauSettings &to, float factor) {
+    return {
+        .temperature     = static_cast<Temperature>(std::lerp(from.temperature, to.temperature, factor)),
+        .saturation      = std::lerp(from.saturation, to.saturation, factor),
+        .hue             = std::lerp(from.hue,        to.hue,        factor),
+        .contrast        = std::lerp(from.contrast,   to.contrast,   factor),
+        .gamma           = std::lerp(from.gamma,      to.gamma,      factor),
+        .luminance       = std::lerp(from.luminance,  to.luminance,  factor),
+        .range           = {
+                           std::lerp(from.range.lo,   to.range.lo,   factor),
+                           std::lerp(from.range.hi,   to.range.hi,   factor),
+        },
+    };
+}
+
+// Insertion sort by time, stable like std::stable_sort but without its temporary buffer, as the sysmodule has no heap
+void sort_keyframes(std::span<Schedule::Keyframe> keyframes) {
+    for (std::size_t i = 1; i < keyframes.size(); ++i) {
+        for (auto j = i; (j > 0) && (keyframes[j].time < keyframes[j - 1].time); --j)
+            std::swap(keyframes[j], keyframes[j - 1]);
+    }
+}
+
+} // namespace
+
+std::pair<Timestamp, Timestamp> Schedule::get_segment(std::size_t idx) const {
+    // Start and duration, the last segment wraps around to the first keyframe of the next day
+    auto start = this->keyframes[idx].time;
+    if (idx + 1 < this->nb_keyframes)
+        return { start, this->keyframes[idx + 1].time - start };
+    return { start, this->keyframes[0].time + day - start };
+}
+
+void Schedule::set(std::span<const Keyframe> keyframes) {
+    this->nb_keyframes = std::min(keyframes.size(), MaxKeyframes);
+    std::copy_n(keyframes.begin(), this->nb_keyframes, this->keyframes.begin());
+
+    auto keyframes_span = std::span(this->keyframes.data(), this->nb_keyframes);
+    std::for_each(keyframes_span.begin(), keyframes_span.end(), [](Keyframe &keyframe) { keyframe.time %= day; });
+    sort_keyframes(keyframes_span);
+
+    this->cursor = 0, this->nb_windows = 0;
+    for (std::size_t i = 0; i < this->nb_keyframes; ++i) {
+        auto [start, length] = this->get_segment(i);
+
+        // A segment spanning the whole day means all keyframes coincide, it holds the settings of the last one
+        if (!length || (length == day) || (this->keyframes[i].settings == this->keyframes[(i + 1) % this->nb_keyframes].settings))
+            continue;
+
+        if (auto end = start + length; end < day) {
+            this->windows[this->nb_windows++] = { start, end };
+        } else {
+            this->windows[this->nb_windows++] = { start, day - 1 };
+            this->windows[this->nb_windows++] = { 0, end - day };
+        }
+    }
+}
+
+void Schedule::set(const FizeauProfile &profile) {
+    std::array<Keyframe, MaxKeyframes> keyframes;
+
+    if (!profile.nb_keyframes) {
+        // In the order of a day, which is kept for windows of zero length
+        std::array<Keyframe, 4> defaults = {{
+            { to_timestamp(profile.dawn_end),   profile.day_settings,   FizeauPeriod_Day   },
+            { to_timestamp(profile.dusk_begin), profile.day_settings,   FizeauPeriod_Dusk  },
+            { to_timestamp(profile.dusk_end),   profile.night_settings, FizeauPeriod_Night },
+            { to_timestamp(profile.dawn_begin), profile.night_settings, FizeauPeriod_Dawn  },
+        }};
+
+        // Start from the earliest keyframe, taking the first of those sharing its time, so that sorting keeps the order of the day
+        std::size_t first = 0;
+        for (std::size_t i = 0; i < defaults.size(); ++i) {
+            auto &prev = defaults[(i + defaults.size() - 1) % defaults.size()];
+            if ((defaults[i].time < defaults[first].time) ||
+                    ((defaults[i].time == defaults[first].time) && (prev.time != defaults[i].time)))
+                first = i;
+        }
+
+        std::rotate_copy(defaults.begin(), defaults.begin() + first, defaults.end(), keyframes.begin());
+        return this->set(std::span(keyframes.data(), defaults.size()));
+    }
+
+    auto count = std::min<std::size_t>(profile.nb_keyframes, MaxKeyframes);
+    for (std::size_t i = 0; i < count; ++i)
+        keyframes[i] = { to_timestamp(profile.keyframes[i].time) % day, profile.keyframes[i].settings };
+
+    auto first = keyframes.begin(), last = keyframes.begin() + count;
+    sort_keyframes(std::span(first, last));
+
+    // Keyframes warmer than the midpoint of the temperatures stand for the night,
+    // and segments are named after the ends they go between
+    auto [coolest, warmest] = std::minmax_element(first, last, [](const Keyframe &l, const Keyframe &r) {
+        return l.settings.temperature > r.settings.temperature;
+    });
+    auto is_night = [midpoint = coolest->settings.temperature + warmest->settings.temperature](const Keyframe &keyframe) {
+        return 2 * keyframe.settings.temperature < midpoint;
+    };
+
+    for (std::size_t i = 0; i < count; ++i) {
+        bool from = is_night(keyframes[i]), to = is_night(keyframes[(i + 1) % count]);
+        keyframes[i].period = from ? (to ? FizeauPeriod_Night : FizeauPeriod_Dawn) : (to ? FizeauPeriod_Dusk : FizeauPeriod_Day);
+    }
+
+    this->set(std::span(keyframes.data(), count));
+}
+
+Schedule::Sample Schedule::sample(Timestamp ts) const {
+    Sample out = {
+        .settings = Config::default_settings,
+    };
+
+    if (!this->nb_keyframes)
+        return out;
+
+    // Segments cover the whole day, so this finds one within a single turn
+    for (std::size_t i = 0; i < this->nb_keyframes; ++i, this->cursor = (this->cursor + 1) % this->nb_keyframes) {
+        auto [start, length] = this->get_segment(this->cursor);
+        auto offset = (ts + day - start) % day;
+        if (offset >= length)
+            continue;
+
+        auto &from = this->keyframes[this->cursor], &to = this->keyframes[(this->cursor + 1) % this->nb_keyframes];
+
+        out.segment = this->cursor;
+        if ((length == day) || (from.settings == to.settings)) {
+            out.settings = from.settings;
+        } else {
+            out.factor   = static_cast<float>(length - offset) / static_cast<float>(length);
+            out.from     = &to.settings, out.to = &from.settings;
+            out.settings = interpolate_settings(*out.from, *out.to, out.factor);
+        }
+        break;
+    }
+
+    return out;
+}
+
+std::pair<FizeauPeriod, float> Schedule::get_period(const Sample &sample) const {
+    if (!this->nb_keyframes)
+        return { FizeauPeriod_Day, 0.0f };
+
+    // Keyframes show the night when the segment starting at them does or leaves it
+    auto is_night = [](const Keyframe &keyframe) {
+        return (keyframe.period == FizeauPeriod_Night) || (keyframe.period == FizeauPeriod_Dawn);
+    };
+
+    // Weight of the settings of the first keyframe of the segment, which are held when both keyframes match
+    auto &from = this->keyframes[sample.segment], &to = this->keyframes[(sample.segment + 1) % this->nb_keyframes];
+    auto weight = sample.from ? sample.factor : 1.0f;
+
+    return { from.period, is_night(from) * weight + is_night(to) * (1.0f - weight) };
+}
+
+Timestamp Schedule::next_keyframe(Timestamp ts) const {
+    Timestamp next = day;
+    for (auto &keyframe: this->get_keyframes())
+        next = std::min(next, (keyframe.time > ts) ? keyframe.time - ts : keyframe.time + day - ts);
+    return next;
+}
+
+} // namespace fz
@@ -0,0 +1,96 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <span>
+#include <utility>
+
+#include <common.hpp>
+
+namespace fz {
+
+// Daily schedule of settings keyframes, interpolated linearly between consecutive ones.
+// Keyframes are sorted by time, and the last one is followed by the first one of the next day,
+// so segments can cross midnight. Segments between keyframes with identical settings hold them.
+// Sampling keeps a cursor on the last segment, so sampling increasing timestamps is O(1)
+class Schedule {
+    public:
+        constexpr static std::size_t MaxKeyframes = FIZEAU_PROFILE_MAX_KEYFRAMES;
+
+        // Each interpolating segment is a window, the one crossing midnight is split in two
+        constexpr static std::size_t MaxWindows = MaxKeyframes + 1;
+
+        struct Keyframe {
+            Timestamp time;
+            FizeauSettings settings;
+            FizeauPeriod period; // Of the segment starting at this keyframe
+        };
+
+        struct Sample {
+            FizeauSettings settings;
+
+            // Index of the segment, which is that of its first keyframe
+            std::uint32_t segment = 0;
+
+            // Endpoints and factor of the interpolation, if any, such that settings = lerp(*from, *to, factor)
+            const FizeauSettings *from = nullptr, *to = nullptr;
+            float factor = 0.0f;
+        };
+
+        // Bounds of a window where the settings change, both included
+        using Window = std::pair<Timestamp, Timestamp>;
+
+    public:
+        // At most MaxKeyframes are used. Keyframes with the same time keep their relative order
+        void set(std::span<const Keyframe> keyframes);
+
+        // Keyframes of the profile, or when it has none, its day and night settings held between the dusk and dawn windows
+        void set(const FizeauProfile &profile);
+
+        Sample sample(Timestamp ts) const;
+
+        // Period of the day of a sample, along with the weight of the night settings in what it shows
+        std::pair<FizeauPeriod, float> get_period(const Sample &sample) const;
+
+        // Seconds until the first keyframe after ts, possibly on the next day, where the segment and its period change
+        Timestamp next_keyframe(Timestamp ts) const;
+
+        std::span<const Keyframe> get_keyframes() const {
+            return std::span(this->keyframes.data(), this->nb_keyframes);
+        }
+
+        std::span<const Window> get_windows() const {
+            return std::span(this->windows.data(), this->nb_windows);
+        }
+
+    private:
+        std::pair<Timestamp, Timestamp> get_segment(std::size_t idx) const;
+
+    private:
+        std::array<Keyframe, MaxKeyframes> keyframes = {};
+        std::size_t nb_keyframes = 0;
+
+        std::array<Window, MaxWindows> windows = {};
+        std::size_t nb_windows = 0;
+
+        mutable std::size_t cursor = 0;
+};
+
+} // namespace fz
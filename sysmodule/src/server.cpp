@@ -16,6 +16,9 @@
 // along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstring>
+#include <algorithm>
+#include <span>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
@@ -30,19 +33,21 @@ namespace fz {
     *out_datasize = sizeof(v);                          \
 })
 
-Result Server::command_handler(void *userdata, const IpcServerRequest *r, u8 *out_data, size_t *out_datasize) {
+Result Server::command_handler(void *userdata, const IpcServerRequest *r, u8 *out_data, size_t *out_datasize, Handle *out_handle) {
     auto *self = static_cast<Server *>(userdata);
 
     switch (r->data.cmdId) {
         case FizeauCommandId_GetIsActive: {
-            SET_OUTDATA(self->context.is_active);
+            SET_OUTDATA(self->context.shared.peek().is_active);
             break;
         }
         case FizeauCommandId_SetIsActive: {
-            auto prev_active = std::exchange(self->context.is_active, *(bool *)r->data.ptr);
+            auto is_active = *(bool *)r->data.ptr;
 
-            if (prev_active != self->context.is_active)
-                self->profile.update_active();
+            if (is_active != self->context.shared.peek().is_active) {
+                self->context.shared.write([is_active](auto &shared) { shared.is_active = is_active; });
+                self->profile.request_commit();
+            }
 
             break;
         }
@@ -51,7 +56,15 @@ Result Server::command_handler(void *userdata, const IpcServerRequest *r, u8 *ou
             if (id < FizeauProfileId_Profile1 || id > FizeauProfileId_Profile4)
                 return FIZEAU_MAKERESULT(INVALID_PROFILEID);
 
-            SET_OUTDATA(self->context.profiles[id]);
+            // Profiles are larger than the inline data, along with their keyframes
+            if (r->hipc.meta.num_recv_buffers < 1)
+                return FIZEAU_MAKERESULT(INVALID_BUFFER);
+
+            auto &buffer = r->hipc.data.recv_buffers[0];
+            if (hipcGetBufferSize(&buffer) < sizeof(FizeauProfile))
+                return FIZEAU_MAKERESULT(INVALID_BUFFER);
+
+            std::memcpy(hipcGetBufferAddress(&buffer), &self->context.shared.peek().profiles[id], sizeof(FizeauProfile));
             break;
         }
         case FizeauCommandId_SetProfile: {
@@ -59,18 +72,27 @@ Result Server::command_handler(void *userdata, const IpcServerRequest *r, u8 *ou
             if (id < FizeauProfileId_Profile1 || id > FizeauProfileId_Profile4)
                 return FIZEAU_MAKERESULT(INVALID_PROFILEID);
 
-            self->context.profiles[id] = *(FizeauProfile *)((std::uint8_t *)r->data.ptr + std::max(alignof(FizeauProfileId), alignof(FizeauProfile)));
+            if (r->hipc.meta.num_send_buffers < 1)
+                return FIZEAU_MAKERESULT(INVALID_BUFFER);
 
-            if (id == self->context.internal_profile || id == self->context.external_profile) {
-                if (auto rc = self->profile.apply(); R_FAILED(rc))
-                    return rc;
-            }
+            auto &buffer = r->hipc.data.send_buffers[0];
+            if (hipcGetBufferSize(&buffer) < sizeof(FizeauProfile))
+                return FIZEAU_MAKERESULT(INVALID_BUFFER);
+
+            auto *profile = hipcGetBufferAddress(&buffer);
+            self->context.shared.write([id, profile](auto &shared) { std::memcpy(&shared.profiles[id], profile, sizeof(FizeauProfile)); });
+            self->profile.modify_fields(id, FizeauProfileField_All);
+
+            auto &shared = self->context.shared.peek();
+            if (id == shared.internal_profile || id == shared.external_profile)
+                self->profile.request_commit();
 
             break;
         }
         case FizeauCommandId_GetActiveProfileId: {
             auto external = *(bool *)r->data.ptr;
-            SET_OUTDATA(!external ? self->context.internal_profile : self->context.external_profile);
+            auto &shared = self->context.shared.peek();
+            SET_OUTDATA(!external ? shared.internal_profile : shared.external_profile);
             break;
         }
         case FizeauCommandId_SetActiveProfileId: {
@@ -79,11 +101,183 @@ Result Server::command_handler(void *userdata, const IpcServerRequest *r, u8 *ou
             if (id < FizeauProfileId_Profile1 || id > FizeauProfileId_Profile4)
                 return FIZEAU_MAKERESULT(INVALID_PROFILEID);
 
-            (!external ? self->context.internal_profile : self->context.external_profile) = id;
+            self->context.shared.write([external, id](auto &shared) {
+                (!external ? shared.internal_profile : shared.external_profile) = id;
+            });
+            self->profile.request_commit();
+
+            break;
+        }
+        case FizeauCommandId_ApplyTransaction: {
+            if (r->hipc.meta.num_send_buffers < 1)
+                return FIZEAU_MAKERESULT(INVALID_TRANSACTION);
+
+            auto &buffer = r->hipc.data.send_buffers[0];
+            auto entries = std::span(static_cast<const FizeauTransactionEntry *>(hipcGetBufferAddress(&buffer)),
+                hipcGetBufferSize(&buffer) / sizeof(FizeauTransactionEntry));
+
+            // Validated beforehand, so that the transaction is applied entirely or not at all
+            for (auto &entry: entries) {
+                switch (entry.op) {
+                    case FizeauTransactionOp_SetIsActive:
+                        break;
+                    case FizeauTransactionOp_SetActiveProfileId:
+                    case FizeauTransactionOp_SetProfile:
+                        if (entry.id < FizeauProfileId_Profile1 || entry.id > FizeauProfileId_Profile4)
+                            return FIZEAU_MAKERESULT(INVALID_PROFILEID);
+                        break;
+                    default:
+                        return FIZEAU_MAKERESULT(INVALID_TRANSACTION);
+                }
+            }
+
+            // A single write, which the profile manager picks up as one modification
+            self->context.shared.write([&entries](auto &shared) {
+                for (auto &entry: entries) {
+                    switch (entry.op) {
+                        case FizeauTransactionOp_SetIsActive:
+                            shared.is_active = entry.is_active;
+                            break;
+                        case FizeauTransactionOp_SetActiveProfileId:
+                            (!entry.is_external ? shared.internal_profile : shared.external_profile) = entry.id;
+                            break;
+                        case FizeauTransactionOp_SetProfile:
+                            shared.profiles[entry.id] = entry.profile;
+                            break;
+                    }
+                }
+            });
+
+            for (auto &entry: entries) {
+                if (entry.op == FizeauTransactionOp_SetProfile)
+                    self->profile.modify_fields(entry.id, FizeauProfileField_All);
+            }
+
+            self->profile.request_commit();
+            break;
+        }
+        case FizeauCommandId_SetProfileFields: {
+            if (r->data.size < sizeof(FizeauProfileId) + sizeof(std::uint32_t))
+                return FIZEAU_MAKERESULT(INVALID_FIELDS);
+
+            FizeauProfileId id;
+            std::uint32_t fields;
+            std::memcpy(&id,     r->data.ptr,                                     sizeof(id));
+            std::memcpy(&fields, (const std::uint8_t *)r->data.ptr + sizeof(id), sizeof(fields));
+
+            if (id < FizeauProfileId_Profile1 || id > FizeauProfileId_Profile4)
+                return FIZEAU_MAKERESULT(INVALID_PROFILEID);
+
+            std::size_t size = 0;
+            for (std::size_t i = 0; i < FizeauProfileFieldIdx_Total; ++i)
+                size += (fields & BIT(i)) ? fizeau_profile_field_layouts[i].size : 0;
+
+            if (fields & ~FizeauProfileField_All)
+                return FIZEAU_MAKERESULT(INVALID_FIELDS);
+
+            if (!fields)
+                break;
+
+            // The values, which can be larger than the inline data
+            if (r->hipc.meta.num_send_buffers < 1)
+                return FIZEAU_MAKERESULT(INVALID_BUFFER);
+
+            auto &buffer = r->hipc.data.send_buffers[0];
+            if (hipcGetBufferSize(&buffer) < size)
+                return FIZEAU_MAKERESULT(INVALID_FIELDS);
+
+            auto *data = static_cast<const std::uint8_t *>(hipcGetBufferAddress(&buffer));
 
-            if (auto rc = self->profile.apply(); R_FAILED(rc))
+            // Values are packed in the order of the field indices
+            self->context.shared.write([id, fields, data](auto &shared) {
+                auto *profile = reinterpret_cast<std::uint8_t *>(&shared.profiles[id]);
+                auto *src = data;
+                for (std::size_t i = 0; i < FizeauProfileFieldIdx_Total; ++i) {
+                    if (!(fields & BIT(i)))
+                        continue;
+
+                    auto &layout = fizeau_profile_field_layouts[i];
+                    std::memcpy(profile + layout.offset, src, layout.size);
+                    src += layout.size;
+                }
+            });
+            self->profile.modify_fields(id, fields);
+
+            // Commits nothing when the modified fields don't affect what the displays show
+            auto &shared = self->context.shared.peek();
+            if (id == shared.internal_profile || id == shared.external_profile)
+                self->profile.request_commit();
+
+            break;
+        }
+        case FizeauCommandId_GetState: {
+            // Larger than the inline response data
+            if (r->hipc.meta.num_recv_buffers < 1)
+                return FIZEAU_MAKERESULT(INVALID_BUFFER);
+
+            auto &buffer = r->hipc.data.recv_buffers[0];
+            if (hipcGetBufferSize(&buffer) < sizeof(FizeauState))
+                return FIZEAU_MAKERESULT(INVALID_BUFFER);
+
+            // Filled in place, the state is too large for the stack along with its profiles
+            auto &shared = self->context.shared.peek();
+            auto &state  = *static_cast<FizeauState *>(hipcGetBufferAddress(&buffer));
+            state.is_active        = shared.is_active;
+            state.internal_profile = shared.internal_profile;
+            state.external_profile = shared.external_profile;
+            std::copy(shared.profiles.begin(), shared.profiles.end(), state.profiles);
+            std::tie(state.period, state.factor) = self->profile.get_current_period();
+            state.is_dimmed  = self->profile.get_is_dimming();
+            state.generation = self->profile.get_state_generation();
+            break;
+        }
+        case FizeauCommandId_GetStateEvent: {
+            if (auto rc = self->profile.get_state_event(r->session, *out_handle); R_FAILED(rc))
                 return rc;
+            break;
+        }
+        case FizeauCommandId_GetStateGeneration: {
+            SET_OUTDATA(self->profile.get_state_generation());
+            break;
+        }
+        case FizeauCommandId_SetPreviewSettings: {
+            if (r->data.size < sizeof(FizeauSettings) + sizeof(std::uint32_t))
+                return FIZEAU_MAKERESULT(INVALID_FIELDS);
+
+            FizeauSettings settings;
+            std::uint32_t timeout_ms;
+            std::memcpy(&settings,   r->data.ptr,                                           sizeof(settings));
+            std::memcpy(&timeout_ms, (const std::uint8_t *)r->data.ptr + sizeof(settings), sizeof(timeout_ms));
 
+            auto timeout_ns = std::min<std::uint64_t>(timeout_ms, FIZEAU_PREVIEW_MAX_TIMEOUT_MS) * 1'000'000;
+            if (auto rc = self->profile.set_preview(settings, timeout_ns, self->receive_tick); R_FAILED(rc))
+                return rc;
+            break;
+        }
+        case FizeauCommandId_EndPreview: {
+            self->profile.end_preview();
+            self->profile.request_commit();
+            break;
+        }
+        case FizeauCommandId_WaitForCommit: {
+            if (auto rc = self->profile.wait_for_commit(); R_FAILED(rc))
+                return rc;
+            break;
+        }
+        case FizeauCommandId_GetWatchdogStats: {
+            SET_OUTDATA(self->profile.get_watchdog_stats());
+            break;
+        }
+        case FizeauCommandId_GetCommitStats: {
+            SET_OUTDATA(self->profile.get_commit_stats());
+            break;
+        }
+        case FizeauCommandId_GetWakeupStats: {
+            SET_OUTDATA(self->profile.get_wakeup_stats());
+            break;
+        }
+        case FizeauCommandId_GetPreviewStats: {
+            SET_OUTDATA(self->profile.get_preview_stats());
             break;
         }
         default:
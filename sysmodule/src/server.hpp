@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU General Public License
 // along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstdint>
+#include <algorithm>
+#include <span>
 #include <string_view>
 
 #include "context.hpp"
@@ -28,6 +31,8 @@ class Server: public IpcServer {
         constexpr static inline std::string_view ServiceName = "fizeau";
         constexpr static inline int ServiceNumSessions = 2;
 
+        static_assert(ServiceNumSessions <= ProfileManager::MaxSessions, "Each session needs its own state event");
+
     public:
         constexpr Server(Context &context, ProfileManager &profile): IpcServer(), context(context), profile(profile) { }
 
@@ -39,32 +44,45 @@ class Server: public IpcServer {
             return ipcServerExit(this);
         }
 
-        Result process() {
-            return ipcServerProcess(this, &command_handler, this);
+        // Reactor source, waiting on the service port and the open sessions
+        std::size_t get_handles(std::span<Handle> handles) const {
+            auto count = std::min<std::size_t>(this->count, handles.size());
+            std::copy_n(this->handles, count, handles.begin());
+            return count;
+        }
+
+        std::uint64_t get_deadline() const {
+            return UINT64_MAX;
         }
 
-        Result loop() {
-            while (true) {
-                switch (auto rc = this->process()) {
-                    case 0:
-                    case KERNELRESULT(ConnectionClosed):
-                        break;
-                    default:
-                        if (R_MODULE(rc) != FIZEAU_RC_MODULE)
-                            return rc;
-                        break;
-                }
+        Result dispatch(std::int32_t idx) {
+            // Time the request was received, latencies are measured from here
+            this->receive_tick = armGetSystemTick();
+
+            // Closed sessions are removed from the handles, their state event goes with them
+            auto session = ((idx > 0) && (static_cast<std::uint32_t>(idx) < this->count)) ? this->handles[idx] : INVALID_HANDLE;
+            auto rc = ipcServerProcessHandle(this, &command_handler, this, idx);
+            if ((session != INVALID_HANDLE) && (std::find(this->handles, this->handles + this->count, session) == this->handles + this->count))
+                this->profile.release_state_event(session);
+
+            switch (rc) {
+                case 0:
+                case KERNELRESULT(ConnectionClosed):
+                    return 0;
+                default:
+                    return (R_MODULE(rc) != FIZEAU_RC_MODULE) ? rc : 0;
             }
         }
 
     private:
-        static Result command_handler(void *userdata, const IpcServerRequest *r, u8 *out_data, size_t *out_datasize);
+        static Result command_handler(void *userdata, const IpcServerRequest *r, u8 *out_data, size_t *out_datasize, Handle *out_handle);
 
     private:
         Context &context;
         ProfileManager &profile;
 
         bool running = false;
+        std::uint64_t receive_tick = 0;
 };
 
 } // namespace fz
@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
 
+#pragma once
+
 #include <cstdint>
 
 #define CLOCK_IO_BASE 0x60006000
@@ -46,6 +48,7 @@
 
 #define DISP_IO_BASE 0x54200000
 #define DISP_IO_SIZE (0x80000)
+#define DISP_B_OFFSET 0x40000
 
 #define DC_CMD_STATE_CONTROL       0x104
 #   define GENERAL_ACT_REQ         (1 <<  0)
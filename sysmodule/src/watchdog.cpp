@@ -0,0 +1,66 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <utility>
+
+#include "watchdog.hpp"
+
+namespace fz {
+
+void CmuWatchdog::arm(std::uint64_t now) {
+    this->interval  = MinInterval;
+    this->burst_end = now + BurstDuration;
+    this->deadline  = std::min(this->deadline, now + MinInterval);
+}
+
+void CmuWatchdog::verify(std::uint64_t now) {
+    this->is_verifying = true;
+    this->deadline     = std::min(this->deadline, now + MinInterval);
+}
+
+void CmuWatchdog::report(std::uint64_t now, bool is_reset) {
+    ++this->stats.nb_checks;
+
+    if (is_reset) {
+        // The reset happened at some point since the last successful check
+        auto latency = (now - std::min(this->last_ok, now)) / 1000;
+        ++this->stats.nb_resets;
+        this->stats.total_latency_us += latency;
+        this->stats.max_latency_us    = std::max(this->stats.max_latency_us, latency);
+    } else {
+        this->last_ok = now;
+    }
+
+    // Verifications of commits keep the current interval
+    if (is_reset || (now < this->burst_end))
+        this->interval = MinInterval;
+    else if (!std::exchange(this->is_verifying, false))
+        this->interval = std::min(this->interval * 2, MaxInterval);
+    this->is_verifying = false;
+
+    this->deadline = now + this->interval;
+}
+
+void CmuWatchdog::skip(std::uint64_t now) {
+    // Bursts are pointless without checks, leaving gating arms a new one
+    this->is_verifying = false;
+    this->interval = std::min(this->interval * 2, MaxInterval);
+    this->deadline = now + this->interval;
+}
+
+} // namespace fz
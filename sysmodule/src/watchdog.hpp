@@ -0,0 +1,79 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+
+#include <common.hpp>
+
+namespace fz {
+
+// Schedules the read-back checks of the cmu registers.
+// Checks run every frame for a short burst after an event likely to reset the cmu,
+// then back off exponentially while the hardware state stays stable.
+// All times are in nanoseconds of system time
+class CmuWatchdog {
+    public:
+        constexpr static std::uint64_t MinInterval   = std::chrono::nanoseconds(std::chrono::milliseconds(16)).count();
+        constexpr static std::uint64_t MaxInterval   = MinInterval << 6;
+        constexpr static std::uint64_t BurstDuration = std::chrono::nanoseconds(std::chrono::seconds(1)).count();
+
+        constexpr static std::size_t NbRegisters = 9;
+
+    public:
+        // Starts a burst, after a mode change or the display leaving clock gating
+        void arm(std::uint64_t now);
+
+        // Schedules a single full check after a commit, without a burst nor resetting the backoff.
+        // Transitions commit up to once per second, which would otherwise keep the checks bursting
+        void verify(std::uint64_t now);
+
+        std::uint64_t get_deadline() const {
+            return this->deadline;
+        }
+
+        // Bursts read back all csc registers, otherwise a single rotating one is compared
+        bool is_full_check(std::uint64_t now) const {
+            return this->is_verifying || (now < this->burst_end);
+        }
+
+        std::size_t next_register() {
+            return this->register_idx++ % NbRegisters;
+        }
+
+        // Records the result of a check, and schedules the next one
+        void report(std::uint64_t now, bool is_reset);
+
+        // Schedules the next check without one taking place, eg. while the display is clock gated
+        void skip(std::uint64_t now);
+
+        // Read by the ipc handlers, which run on the same reactor thread
+        const FizeauWatchdogStats &get_stats() const {
+            return this->stats;
+        }
+
+    private:
+        std::uint64_t interval = MinInterval, deadline = 0, burst_end = 0, last_ok = 0;
+        std::size_t register_idx = 0;
+        bool is_verifying = false;
+
+        FizeauWatchdogStats stats = {};
+};
+
+} // namespace fz
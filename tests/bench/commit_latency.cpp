@@ -0,0 +1,98 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <chrono>
+
+#include <common.hpp>
+
+#include "context.hpp"
+#include "nvdisp.hpp"
+#include "profile.hpp"
+
+using namespace fz;
+
+namespace {
+
+constexpr int nb_iterations = 2000, burst = 16;
+
+// Handler side of SetProfile, up to the point where the reply is sent
+void set_profile(Context &context, ProfileManager &pm, const FizeauProfile &profile) {
+    context.shared.write([&](ContextSnapshot &s) { s.profiles[FizeauProfileId_Profile1] = profile; });
+    pm.modify_fields(FizeauProfileId_Profile1, FizeauProfileField_All);
+    pm.request_commit();
+}
+
+// Runs func over a sweep of temperatures, so that every commit misses the cmu cache, and prints the average time per call
+template <typename F>
+void bench(const char *name, F &&func) {
+    auto profile = FizeauProfile{
+        .day_settings = Config::default_settings, .night_settings = Config::default_settings,
+        .components = Component_All, .filter = Component_None,
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nb_iterations; ++i) {
+        profile.day_settings.temperature = profile.night_settings.temperature = 2000 + i % 4000;
+        func(profile);
+    }
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+    std::printf("%-32s %8.2fus\n", name, elapsed.count() / nb_iterations);
+}
+
+} // namespace
+
+// Round trip of the profile setters as seen by the client, with the ioctls stubbed out: the reply is sent once the state is
+// stored, and the commit happens on the next wakeup of the reactor. WaitForCommit gives back the synchronous behaviour
+int main() {
+    Context context;
+    DisplayController disp;
+    ProfileManager pm(context, disp);
+
+    Clock::initialize();
+    disp.initialize();
+    pm.initialize();
+
+    context.shared.write([](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+    });
+    pm.dispatch(-1);
+
+    bench("SetProfile", [&](const FizeauProfile &profile) {
+        set_profile(context, pm, profile);
+    });
+    pm.dispatch(-1);
+
+    bench("SetProfile + WaitForCommit", [&](const FizeauProfile &profile) {
+        set_profile(context, pm, profile);
+        pm.wait_for_commit();
+    });
+
+    // Bursts of slider movements, coalesced in a single commit
+    int n = 0;
+    bench("SetProfile, coalesced burst", [&](const FizeauProfile &profile) {
+        set_profile(context, pm, profile);
+        if (++n % burst == 0)
+            pm.dispatch(-1);
+    });
+
+    auto &stats = pm.get_commit_stats();
+    std::printf("%u cmu commits, %u skipped, %u failed\n", stats.nb_cmu_issued, stats.nb_cmu_skipped, stats.nb_failed);
+
+    pm.finalize();
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <array>
+#include <chrono>
+
+#include <common.hpp>
+
+using namespace fz;
+
+namespace {
+
+constexpr int nb_iterations = 20000;
+
+std::array<std::uint16_t, 960> lut;
+
+// Runs func over a sweep of gammas, and prints the average time per call
+template <typename F>
+void bench(const char *name, F &&func) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nb_iterations; ++i) {
+        func(1.0f + (i % 300) * 0.01f);
+        asm volatile ("" ::: "memory");
+    }
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+    std::printf("%-32s %8.2fus\n", name, elapsed.count() / nb_iterations);
+}
+
+} // namespace
+
+// Time of the LUT calculations of the sysmodule, with the std::pow reference and the fastmath kernels.
+// The scalar variants wrap the kernel in a lambda only taking floats, which disables the vector loop
+int main() {
+    std::printf("%zu lanes\n", simd::lanes);
+
+    bench("LUT1 std::pow", [](Gamma g) {
+        gamma_ramp(degamma, lut.data(), 256, g, 12, 0.0f, 1.0f, 0.0f);
+    });
+    bench("LUT1 fastmath", [](Gamma g) {
+        degamma_ramp(lut.data(), 256, g, 12);
+    });
+
+    bench("LUT2 std::pow, multi-pass", [](Gamma g) {
+        gamma_ramp(regamma, lut.data(), 512, g, 8, 0.0f, 0.125f, 0.0f);
+        gamma_ramp(regamma, lut.data() + 512, 448, g, 8, 0.125f, 1.0f, 0.0f);
+        apply_luma(lut.data(), 960, 8, -0.2f);
+        apply_range(lut.data(), 960, 8, 16.0f / 255.0f, 235.0f / 255.0f);
+    });
+    bench("LUT2 fastmath, scalar", [](Gamma g) {
+        auto kernel = impl::regamma_kernel(g);
+        auto luma_range = impl::LumaRange(kernel(1.0f), -0.2f, { 16.0f / 255.0f, 235.0f / 255.0f });
+        auto func = [&](float x) { return luma_range(kernel(x)); };
+        impl::ramp(func, lut.data(), 512, 8, 0.0f, 0.125f, 0.0f);
+        impl::ramp(func, lut.data() + 512, 448, 8, 0.125f, 1.0f, 0.0f);
+    });
+    bench("LUT2 fastmath", [](Gamma g) {
+        regamma_ramp(lut.data(), 512, g, 8, 0.0f, 0.125f, 0.0f, -0.2f, { 16.0f / 255.0f, 235.0f / 255.0f });
+        regamma_ramp(lut.data() + 512, 448, g, 8, 0.125f, 1.0f, 0.0f, -0.2f, { 16.0f / 255.0f, 235.0f / 255.0f });
+    });
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include "nvdisp.hpp"
+
+namespace fz {
+
+// In-memory model of the cmu registers of both display controllers, for exercising RegisterCmuBackend off-target.
+// Writes only take effect once latched by an activation request, like on hardware. Each write is logged
+struct MockRegisterFile {
+    struct Write {
+        std::uint32_t off, val;
+    };
+
+    struct Controller {
+        bool is_clocked = true, is_latch_stuck = false;
+        std::uint32_t color_control = CMU_ENABLE, color_control_assembly = CMU_ENABLE;
+
+        std::array<std::uint32_t, 9> csc_assembly = {}, csc_active = {};
+        decltype(Cmu::lut_1) lut_1 = {};
+        decltype(Cmu::lut_2) lut_2 = {};
+
+        std::vector<Write> writes;
+        std::uint32_t nb_latches = 0;
+    };
+
+    std::array<Controller, 2> controllers = {};
+
+    bool is_accessible(bool external) const {
+        return this->controllers[external].is_clocked;
+    }
+
+    std::uint32_t read(bool external, std::uint32_t off) const {
+        auto &ctrl = this->controllers[external];
+        if (off == DC_DISP_DISP_COLOR_CONTROL)
+            return ctrl.color_control;
+        if ((off >= DC_COM_CMU_CSC_KRR) && (off <= DC_COM_CMU_CSC_KBB))
+            return ctrl.csc_active[(off - DC_COM_CMU_CSC_KRR) / sizeof(std::uint32_t)];
+        return 0;
+    }
+
+    void write(bool external, std::uint32_t off, std::uint32_t val) {
+        auto &ctrl = this->controllers[external];
+        ctrl.writes.push_back({ off, val });
+
+        if (off == DC_DISP_DISP_COLOR_CONTROL) {
+            ctrl.color_control_assembly = val;
+        } else if ((off >= DC_COM_CMU_CSC_KRR) && (off <= DC_COM_CMU_CSC_KBB)) {
+            ctrl.csc_assembly[(off - DC_COM_CMU_CSC_KRR) / sizeof(std::uint32_t)] = val;
+        } else if (off == DC_COM_CMU_LUT1) {
+            ctrl.lut_1[LUT1_ADDR(val)] = LUT1_READ_DATA(val);
+        } else if (off == DC_COM_CMU_LUT2) {
+            ctrl.lut_2[LUT2_ADDR(val)] = LUT2_READ_DATA(val);
+        } else if ((off == DC_CMD_STATE_CONTROL) && (val & GENERAL_ACT_REQ) && !ctrl.is_latch_stuck) {
+            ctrl.csc_active    = ctrl.csc_assembly;
+            ctrl.color_control = ctrl.color_control_assembly;
+            ++ctrl.nb_latches;
+        }
+    }
+
+    // Activation requests are latched immediately, unless stuck
+    bool wait_latch(bool external) const {
+        return !this->controllers[external].is_latch_stuck;
+    }
+};
+
+// Stands in for nvdrv, programming the whole cmu
+class MockNvdrvCmuBackend final: public CmuBackend {
+    public:
+        constexpr MockNvdrvCmuBackend(MockRegisterFile &regs): regs(regs) { }
+
+        Result commit(bool external, Cmu &cmu) override {
+            auto &ctrl = this->regs.controllers[external];
+            ++this->nb_commits;
+
+            if (!cmu.enable) {
+                ctrl.color_control = ctrl.color_control_assembly = ctrl.color_control & ~CMU_ENABLE;
+                return 0;
+            }
+
+            for (std::size_t i = 0; i < ctrl.csc_active.size(); ++i)
+                ctrl.csc_active[i] = ctrl.csc_assembly[i] = static_cast<std::uint16_t>((&cmu.krr)[i]) & QS18::BitMask;
+            ctrl.lut_1 = cmu.lut_1;
+            ctrl.lut_2 = cmu.lut_2;
+            ctrl.color_control = ctrl.color_control_assembly = ctrl.color_control | CMU_ENABLE;
+            return 0;
+        }
+
+        std::uint32_t get_nb_commits() const {
+            return this->nb_commits;
+        }
+
+    private:
+        MockRegisterFile &regs;
+        std::uint32_t nb_commits = 0;
+};
+
+} // namespace fz
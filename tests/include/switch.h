@@ -0,0 +1,179 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// Stand-in for the parts of libnx used by the common and sysmodule code, to build and run it on a host.
+// System ticks are nanoseconds, and only advance when a test moves them.
+// Io mappings, events, nvdrv and the services are emulated in support/horizon.cpp
+
+#include <cstddef>
+#include <cstdint>
+
+typedef std::uint8_t  u8;
+typedef std::uint16_t u16;
+typedef std::uint32_t u32;
+typedef std::uint64_t u64;
+typedef std::int32_t  s32;
+typedef std::int64_t  s64;
+
+typedef u32 Result;
+typedef u32 Handle;
+
+#define BIT(n) (1U << (n))
+#define NX_CONSTEXPR static inline constexpr
+
+#define R_FAILED(rc)    ((rc) != 0)
+#define R_SUCCEEDED(rc) ((rc) == 0)
+#define R_MODULE(rc)    ((rc) & 0x1ff)
+#define R_DESCRIPTION(rc) (((rc) >> 9) & 0x1fff)
+#define MAKERESULT(module, description) ((((module) & 0x1ff)) | ((description) & 0x1fff) << 9)
+
+#define INVALID_HANDLE ((Handle)0)
+
+typedef struct {
+    Handle session;
+} Service;
+
+#define KERNELRESULT(x) MAKERESULT(1, KernelError_##x)
+
+enum {
+    KernelError_TimedOut         = 117,
+    KernelError_ConnectionClosed = 123,
+};
+
+enum {
+    Module_Libnx = 345,
+};
+
+enum {
+    LibnxError_OutOfMemory = 2,
+};
+
+// Host side of the stand-in, driven by the tests
+namespace fz::test {
+
+inline u64 system_tick = 0;
+
+// Wall clock, in seconds since midnight
+inline u64 wall_time = 0;
+
+// Memory backing the io mappings, allocated on first query
+u32 *mmio(u64 phys_addr);
+
+// Called for each nvdrv ioctl, succeeds when unset
+inline Result (*nv_ioctl)(u32 fd, u32 request, void *argp) = nullptr;
+
+bool is_signaled(Handle handle);
+
+} // namespace fz::test
+
+[[noreturn]] void diagAbortWithResult(Result rc);
+
+Result svcQueryMemoryMapping(u64 *virtaddr, u64 *out_size, u64 physaddr, u64 size);
+
+// Sleeping advances the fake clock
+static inline void svcSleepThread(s64 nano) {
+    fz::test::system_tick += nano;
+}
+
+// Events
+
+typedef struct {
+    Handle revent, wevent;
+    bool autoclear;
+} Event;
+
+Result eventCreate(Event *t, bool autoclear);
+void eventClose(Event *t);
+Result eventFire(Event *t);
+Result eventClear(Event *t);
+
+// Services
+
+typedef enum {
+    OmmOperationMode_Handheld = 0,
+    OmmOperationMode_Console  = 1,
+} OmmOperationMode;
+
+namespace fz::test {
+
+inline OmmOperationMode operation_mode = OmmOperationMode_Handheld;
+inline u64 last_input_tick = 0;
+
+} // namespace fz::test
+
+Result insrGetLastTick(u32 id, u64 *tick);
+Result insrGetReadableEvent(u32 id, Event *out);
+
+// nvdrv
+
+#define __nv_in
+#define __nv_out
+#define __nv_inout
+
+#define _NV_IOC(dir, type, nr, size) ((u32)(((dir) << 30) | ((size) << 16) | ((type) << 8) | (nr)))
+#define _NV_IOR(type, nr, size)  _NV_IOC(2, type, nr, sizeof(size))
+#define _NV_IOW(type, nr, size)  _NV_IOC(1, type, nr, sizeof(size))
+#define _NV_IOWR(type, nr, size) _NV_IOC(3, type, nr, sizeof(size))
+
+Result nvOpen(u32 *fd, const char *devicepath);
+Result nvClose(u32 fd);
+Result nvIoctl(u32 fd, u32 request, void *argp);
+
+// Time
+
+static inline u64 armGetSystemTick() {
+    return fz::test::system_tick;
+}
+
+static inline u64 armTicksToNs(u64 tick) {
+    return tick;
+}
+
+static inline u64 armNsToTicks(u64 ns) {
+    return ns;
+}
+
+typedef enum {
+    TimeType_Default,
+} TimeType;
+
+typedef struct {
+    u16 year;
+    u8 month, day, hour, minute, second, pad;
+} TimeCalendarTime;
+
+static inline Result timeInitialize() {
+    return 0;
+}
+
+static inline void timeExit() { }
+
+static inline Result timeGetCurrentTime(TimeType, u64 *time) {
+    *time = fz::test::wall_time;
+    return 0;
+}
+
+static inline Result timeToCalendarTimeWithMyRule(u64 time, TimeCalendarTime *caltime, void *) {
+    *caltime = {
+        .hour   = static_cast<u8>(time / (60 * 60) % 24),
+        .minute = static_cast<u8>(time / 60 % 60),
+        .second = static_cast<u8>(time % 60),
+    };
+    return 0;
+}
@@ -0,0 +1,41 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdio>
+
+// Minimal checks for the host tests: failures are reported and counted, and main returns their number
+namespace fz::test {
+
+inline int nb_failures = 0;
+
+inline int result(const char *name) {
+    std::printf("%s: %s (%d failures)\n", name, nb_failures ? "FAILED" : "passed", nb_failures);
+    return nb_failures;
+}
+
+} // namespace fz::test
+
+#define FZ_EXPECT(cond, ...) ({                                                     \
+    if (!(cond)) {                                                                  \
+        std::printf("%s:%d: check failed: %s\n    ", __FILE__, __LINE__, #cond);    \
+        std::printf(__VA_ARGS__);                                                   \
+        std::printf("\n");                                                          \
+        ++fz::test::nb_failures;                                                    \
+    }                                                                               \
+})
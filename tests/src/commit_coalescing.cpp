@@ -0,0 +1,180 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+#include <cstring>
+#include <deque>
+
+#include <common.hpp>
+
+#include "context.hpp"
+#include "nvdisp.hpp"
+#include "profile.hpp"
+#include "reactor.hpp"
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+constexpr std::uint64_t us = 1'000, ms = 1'000'000;
+
+// Handle of the client session, distinct from those of the fake events
+constexpr Handle client_handle = 0x1000;
+
+// Arrival times of the queued SetProfile requests, in ticks
+std::deque<std::uint64_t> requests;
+
+Cmu committed;
+
+Result capture_cmu(u32, u32 request, void *argp) {
+    if (request == _NV_IOWR(2, 14, Cmu))
+        std::memcpy(static_cast<void *>(&committed), argp, sizeof(Cmu));
+    return 0;
+}
+
+// Waits on the fake clock: requests and signaled events are ready once their time has come, otherwise the clock jumps
+// to the timeout
+struct FakeWaiter {
+    using Handle = ::Handle;
+    using Result = ::Result;
+
+    constexpr static std::size_t MaxHandles = 64;
+    constexpr static Result TimedOut = KERNELRESULT(TimedOut);
+
+    static std::uint64_t now() {
+        return armTicksToNs(armGetSystemTick());
+    }
+
+    static Result wait(std::int32_t &idx, std::span<const Handle> handles, std::uint64_t timeout_ns) {
+        auto deadline = (timeout_ns == UINT64_MAX) ? UINT64_MAX : now() + timeout_ns;
+        for (std::size_t i = 0; i < handles.size(); ++i) {
+            if (test::is_signaled(handles[i])) {
+                idx = static_cast<std::int32_t>(i);
+                return 0;
+            }
+
+            if ((handles[i] == client_handle) && !requests.empty() && (requests.front() <= deadline)) {
+                test::system_tick = std::max(test::system_tick, requests.front());
+                idx = static_cast<std::int32_t>(i);
+                return 0;
+            }
+        }
+
+        if (deadline == UINT64_MAX)
+            return KERNELRESULT(ConnectionClosed);
+
+        test::system_tick = std::max(test::system_tick, deadline);
+        return TimedOut;
+    }
+};
+
+// Server side of SetProfile, each request moving the temperature of the active profile by 100K
+struct Client {
+    Context &context;
+    ProfileManager &pm;
+    Temperature temperature = 6500;
+
+    std::size_t get_handles(std::span<Handle> handles) {
+        handles[0] = client_handle;
+        return 1;
+    }
+
+    std::uint64_t get_deadline() {
+        return UINT64_MAX;
+    }
+
+    Result dispatch(std::int32_t) {
+        requests.pop_front();
+        this->temperature -= 100;
+
+        this->context.shared.write([this](ContextSnapshot &s) {
+            s.profiles[FizeauProfileId_Profile1].day_settings.temperature   = this->temperature;
+            s.profiles[FizeauProfileId_Profile1].night_settings.temperature = this->temperature;
+        });
+        this->pm.modify_fields(FizeauProfileId_Profile1, FizeauProfileField_DayTemperature | FizeauProfileField_NightTemperature);
+        this->pm.request_commit();
+
+        // Handling cost of a request
+        test::system_tick += 50 * us;
+        return 0;
+    }
+};
+
+} // namespace
+
+// Bursts of setters through the reactor are committed once, with the latest state, within the commit window
+int main() {
+    test::nv_ioctl = capture_cmu;
+    test::wall_time = 12*60*60, test::system_tick = 0;
+
+    Context context;
+    DisplayController disp, ref;
+    ProfileManager pm(context, disp);
+    Client client = { context, pm };
+    BasicReactor<FakeWaiter, Client, ProfileManager> reactor(client, pm);
+
+    Clock::initialize();
+    disp.initialize();
+    ref.initialize();
+    pm.initialize();
+
+    context.shared.write([](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+        s.profiles[FizeauProfileId_Profile1] = FizeauProfile{
+            .day_settings = Config::default_settings, .night_settings = Config::default_settings,
+            .components = Component_All, .filter = Component_None,
+        };
+    });
+    pm.request_commit();
+    reactor.run_once();
+    reactor.run_once();
+
+    DisplayController::CmuShadow shadow;
+    DisplayController::CmuStages stages;
+
+    for (int burst = 0; burst < 4; ++burst) {
+        // 16 requests queued 100us apart, as from a client sending faster than commits
+        auto start = test::system_tick + 100 * ms;
+        for (int i = 0; i < 16; ++i)
+            requests.push_back(start + i * 100 * us);
+
+        auto commits = disp.get_commit_stats().nb_cmu_issued;
+        std::uint64_t first_commit = 0;
+        while (!requests.empty() || (test::system_tick < start + 10 * ms)) {
+            reactor.run_once();
+            if (!first_commit && (disp.get_commit_stats().nb_cmu_issued != commits))
+                first_commit = test::system_tick;
+        }
+
+        auto nb = disp.get_commit_stats().nb_cmu_issued - commits;
+        FZ_EXPECT(nb == 1, "burst %d: %u commits for 16 requests", burst, nb);
+        FZ_EXPECT(first_commit - start <= commit_window_ns + 100 * us, "burst %d: committed after %lu us", burst,
+            (first_commit - start) / us);
+
+        // The latest request wins
+        auto shown = committed;
+        auto settings = Config::default_settings;
+        settings.temperature = client.temperature;
+        ref.invalidate_committed_state(false);
+        ref.apply_color_profile(false, settings, Component_All, Component_None, shadow, stages);
+        FZ_EXPECT(!std::memcmp(&shown, &committed, sizeof(Cmu)), "burst %d: the latest settings are not shown", burst);
+    }
+
+    pm.finalize();
+    return test::result("commit_coalescing");
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <array>
+#include <cstdint>
+
+#include <common.hpp>
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+// Segments of the LUT2, as calculated by the sysmodule
+struct Segment {
+    std::size_t offset, size;
+    float lo, hi;
+};
+
+constexpr std::array lut2_segments = {
+    Segment{   0, 512, 0.0f,   0.125f },
+    Segment{ 512, 448, 0.125f, 1.0f   },
+};
+
+using Lut1 = std::array<std::uint16_t, 256>;
+using Lut2 = std::array<std::uint16_t, 960>;
+
+std::size_t nb_entries = 0;
+
+template <std::size_t N>
+void compare(const std::array<std::uint16_t, N> &actual, const std::array<std::uint16_t, N> &expected,
+        const char *what, Gamma gamma, Contrast contrast) {
+    for (std::size_t i = 0; i < N; ++i) {
+        FZ_EXPECT(actual[i] == expected[i], "%s, gamma %.2f contrast %.2f, entry %zu: %u, reference %u",
+            what, gamma, contrast, i, actual[i], expected[i]);
+    }
+    nb_entries += N;
+}
+
+float contrast_offset(Contrast contrast) {
+    return (1.0f - contrast_slant(contrast)) / 2.0f;
+}
+
+// degamma_ramp/regamma_ramp against the std::pow reference, over gamma 0..5 and contrast 0..2 in 0.01 steps
+void check_transfer_functions() {
+    Lut1 lut1, lut1_ref;
+    Lut2 lut2, lut2_ref;
+
+    for (int i = 0; i <= 500; ++i) {
+        Gamma gamma = i * 0.01f;
+
+        for (auto nb_bits: { 8, 12 }) {
+            degamma_ramp(lut1.data(), lut1.size(), gamma, nb_bits);
+            gamma_ramp(degamma, lut1_ref.data(), lut1_ref.size(), gamma, nb_bits, 0.0f, 1.0f, 0.0f);
+            compare(lut1, lut1_ref, nb_bits == 8 ? "LUT1 8-bit" : "LUT1 12-bit", gamma, DEFAULT_CONTRAST);
+        }
+
+        for (int j = 0; j <= 200; ++j) {
+            Contrast contrast = j * 0.01f;
+            auto off = contrast_offset(contrast);
+
+            for (auto &s: lut2_segments) {
+                regamma_ramp(lut2.data() + s.offset, s.size, gamma, 8, s.lo, s.hi, off);
+                gamma_ramp(regamma, lut2_ref.data() + s.offset, s.size, gamma, 8, s.lo, s.hi, off);
+            }
+            compare(lut2, lut2_ref, "LUT2", gamma, contrast);
+        }
+    }
+}
+
+// Fused and staged LUT2 against the same arithmetic evaluated with std::pow, with luminance and color range.
+// The multi-pass apply_luma/apply_range rounds after each step, so it isn't expected to match exactly
+void check_luma_range() {
+    constexpr std::array lumas  = { -1.0f, -0.5f, -0.1f, 0.0f, 0.25f, 1.0f };
+    constexpr std::array ranges = {
+        ColorRange{ 0.0f, 1.0f }, ColorRange{ 16.0f / 255.0f, 235.0f / 255.0f },
+        ColorRange{ 0.2f, 0.6f }, ColorRange{ 0.7f, 0.3f },
+    };
+
+    Lut2 fused, staged, reference;
+    std::array<float, std::tuple_size_v<Lut2>> samples;
+
+    for (int i = 1; i <= 50; ++i) {
+        Gamma gamma = i * 0.1f;
+
+        for (int j = 0; j <= 20; ++j) {
+            Contrast contrast = j * 0.1f;
+            auto off = contrast_offset(contrast);
+
+            auto top = regamma(std::clamp(1.0f + off, 0.0f, 1.0f), gamma);
+
+            float samples_top = 0.0f;
+            for (auto &s: lut2_segments) {
+                auto t = regamma_samples(samples.data() + s.offset, s.size, gamma, s.lo, s.hi, off);
+                samples_top = (s.offset == 0) ? t : samples_top;
+            }
+
+            for (auto luma: lumas) {
+                for (auto range: ranges) {
+                    auto luma_range = impl::LumaRange(top, luma, range);
+                    for (auto &s: lut2_segments) {
+                        regamma_ramp(fused.data() + s.offset, s.size, gamma, 8, s.lo, s.hi, off, luma, range);
+                        impl::ramp([&](float x) { return luma_range(regamma(x, gamma)); },
+                            reference.data() + s.offset, s.size, 8, s.lo, s.hi, off);
+                    }
+
+                    luma_range_ramp(samples.data(), staged.data(), staged.size(), 8, samples_top, luma, range);
+
+                    compare(fused,  reference, "fused LUT2",  gamma, contrast);
+                    compare(staged, fused,     "staged LUT2", gamma, contrast);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+// The fastmath ramps replace the std::pow ones, and must produce the same bytes
+int main() {
+    check_transfer_functions();
+    check_luma_range();
+
+    std::printf("gamma_ramps: %zu entries compared\n", nb_entries);
+    return test::result("gamma_ramps");
+}
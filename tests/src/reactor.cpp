@@ -0,0 +1,116 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+#include <csignal>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "reactor.hpp"
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+constexpr std::uint64_t ms = 1'000'000;
+
+int nb_signals = 0;
+
+// Interrupts the waits every 2ms. Without SA_RESTART, poll fails with EINTR on each signal
+void interrupt(bool enable) {
+    struct sigaction action = {};
+    action.sa_handler = [](int) { ++nb_signals; };
+    sigaction(SIGALRM, &action, nullptr);
+
+    itimerval timer = {};
+    if (enable)
+        timer.it_interval = timer.it_value = { .tv_sec = 0, .tv_usec = 2000 };
+    setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+// Pipe, readable after a write
+struct Source {
+    std::array<int, 2> fds = {};
+    std::uint64_t deadline = UINT64_MAX;
+    int nb_reads = 0, nb_timers = 0;
+
+    std::size_t get_handles(std::span<int> handles) {
+        handles[0] = this->fds[0];
+        return 1;
+    }
+
+    std::uint64_t get_deadline() {
+        return this->deadline;
+    }
+
+    int dispatch(std::int32_t idx) {
+        if (idx < 0) {
+            ++this->nb_timers, this->deadline = UINT64_MAX;
+        } else {
+            char c;
+            this->nb_reads += read(this->fds[0], &c, 1);
+        }
+        return 0;
+    }
+};
+
+// Signals neither end a wait early nor report an error
+void check_interrupted_wait() {
+    Source source;
+    pipe(source.fds.data());
+
+    interrupt(true);
+    auto start = PollWaiter::now();
+    std::int32_t idx = -1;
+    auto rc = PollWaiter::wait(idx, std::span(source.fds.data(), 1), 30 * ms);
+    auto elapsed = PollWaiter::now() - start;
+    interrupt(false);
+
+    FZ_EXPECT(nb_signals > 0, "no signal was delivered");
+    FZ_EXPECT(rc == PollWaiter::TimedOut, "wait returned %d", rc);
+    FZ_EXPECT(elapsed >= 30 * ms, "timed out after %lu us", elapsed / 1000);
+
+    close(source.fds[0]), close(source.fds[1]);
+}
+
+// The reactor keeps dispatching handles and timers while interrupted
+void check_interrupted_reactor() {
+    Source source;
+    pipe(source.fds.data());
+    Reactor<Source> reactor(source);
+
+    interrupt(true);
+    write(source.fds[1], "x", 1);
+    FZ_EXPECT(reactor.run_once() == 0, "signaled handle");
+    FZ_EXPECT(source.nb_reads == 1, "%d reads", source.nb_reads);
+
+    source.deadline = PollWaiter::now() + 20 * ms;
+    FZ_EXPECT(reactor.run_once() == 0, "expired timer");
+    FZ_EXPECT(source.nb_timers == 1, "%d timer dispatches", source.nb_timers);
+    interrupt(false);
+
+    close(source.fds[0]), close(source.fds[1]);
+}
+
+} // namespace
+
+int main() {
+    check_interrupted_wait();
+    check_interrupted_reactor();
+
+    return test::result("reactor");
+}
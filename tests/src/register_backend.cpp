@@ -0,0 +1,141 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <common.hpp>
+
+#include "nvdisp.hpp"
+#include "mock_regs.hpp"
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+using Controller = MockRegisterFile::Controller;
+
+Cmu make_cmu(QS18 kgg, std::uint16_t lut_2_entry) {
+    Cmu cmu;
+    for (std::size_t i = 0; i < cmu.lut_1.size(); ++i)
+        cmu.lut_1[i] = i << 4;
+    for (std::size_t i = 0; i < cmu.lut_2.size(); ++i)
+        cmu.lut_2[i] = i / 4;
+
+    cmu.kgg = kgg;
+    cmu.lut_2[lut_2_entry] ^= 1;
+    return cmu;
+}
+
+bool shows(const Controller &ctrl, const Cmu &cmu) {
+    for (std::size_t i = 0; i < ctrl.csc_active.size(); ++i) {
+        if (ctrl.csc_active[i] != (static_cast<std::uint16_t>((&cmu.krr)[i]) & QS18::BitMask))
+            return false;
+    }
+
+    return (ctrl.color_control & CMU_ENABLE) && (ctrl.lut_1 == cmu.lut_1) && (ctrl.lut_2 == cmu.lut_2);
+}
+
+// Diffed commits follow the sequence of the driver: disable, program, update and activate, reenable
+void check_sequence() {
+    MockRegisterFile regs;
+    MockNvdrvCmuBackend nvdrv(regs);
+    RegisterCmuBackend backend(regs, nvdrv);
+    auto &ctrl = regs.controllers[0];
+
+    // The first commit goes through nvdrv, the hardware state being unknown
+    auto first = make_cmu(0.5, 10);
+    backend.commit(false, first);
+    FZ_EXPECT(nvdrv.get_nb_commits() == 1, "%u nvdrv commits", nvdrv.get_nb_commits());
+    FZ_EXPECT(ctrl.writes.empty(), "%zu register writes", ctrl.writes.size());
+    FZ_EXPECT(shows(ctrl, first), "first cmu not shown");
+
+    // Then only the differences are written: one csc coefficient and two LUT2 entries
+    auto second = make_cmu(0.75, 20);
+    backend.commit(false, second);
+    FZ_EXPECT(nvdrv.get_nb_commits() == 1, "%u nvdrv commits", nvdrv.get_nb_commits());
+    FZ_EXPECT(shows(ctrl, second), "second cmu not shown");
+    FZ_EXPECT(backend.get_nb_register_writes() == 3, "%u programming writes", backend.get_nb_register_writes());
+
+    std::uint32_t kgg = static_cast<std::uint16_t>(second.kgg) & QS18::BitMask,
+        lut_2_10 = LUT2_ADDR(10) | LUT2_DATA(second.lut_2[10]), lut_2_20 = LUT2_ADDR(20) | LUT2_DATA(second.lut_2[20]);
+
+    std::array<MockRegisterFile::Write, 9> expected = {{
+        { DC_DISP_DISP_COLOR_CONTROL, 0               },
+        { DC_COM_CMU_CSC_KGG,         kgg             },
+        { DC_COM_CMU_LUT2,            lut_2_10        },
+        { DC_COM_CMU_LUT2,            lut_2_20        },
+        { DC_CMD_STATE_CONTROL,       GENERAL_UPDATE  },
+        { DC_CMD_STATE_CONTROL,       GENERAL_ACT_REQ },
+        { DC_DISP_DISP_COLOR_CONTROL, CMU_ENABLE      },
+        { DC_CMD_STATE_CONTROL,       GENERAL_UPDATE  },
+        { DC_CMD_STATE_CONTROL,       GENERAL_ACT_REQ },
+    }};
+
+    FZ_EXPECT(ctrl.writes.size() == expected.size(), "%zu writes, expected %zu", ctrl.writes.size(), expected.size());
+    for (std::size_t i = 0; i < std::min(ctrl.writes.size(), expected.size()); ++i) {
+        FZ_EXPECT((ctrl.writes[i].off == expected[i].off) && (ctrl.writes[i].val == expected[i].val),
+            "write %zu: %#x = %#x, expected %#x = %#x", i, ctrl.writes[i].off, ctrl.writes[i].val, expected[i].off, expected[i].val);
+    }
+
+    // Identical commits write nothing, so the cmu is never disabled
+    ctrl.writes.clear();
+    backend.commit(false, second);
+    FZ_EXPECT(ctrl.writes.empty(), "%zu writes for an identical commit", ctrl.writes.size());
+}
+
+// Gated controllers, resets, and missed latches fall back to nvdrv
+void check_fallbacks() {
+    MockRegisterFile regs;
+    MockNvdrvCmuBackend nvdrv(regs);
+    RegisterCmuBackend backend(regs, nvdrv);
+    auto &ctrl = regs.controllers[1];
+
+    auto a = make_cmu(0.5, 10), b = make_cmu(0.75, 20);
+    backend.commit(true, a);
+
+    ctrl.is_clocked = false;
+    backend.commit(true, b);
+    FZ_EXPECT(nvdrv.get_nb_commits() == 2, "gated: %u nvdrv commits", nvdrv.get_nb_commits());
+    ctrl.is_clocked = true;
+
+    // nvdrv reprogrammed the controller, with the cmu disabled
+    ctrl.color_control = ctrl.color_control_assembly = 0;
+    backend.commit(true, a);
+    FZ_EXPECT(nvdrv.get_nb_commits() == 3, "reset: %u nvdrv commits", nvdrv.get_nb_commits());
+    FZ_EXPECT(shows(ctrl, a), "cmu not shown after a reset");
+
+    ctrl.is_latch_stuck = true;
+    backend.commit(true, b);
+    FZ_EXPECT(nvdrv.get_nb_commits() == 4, "missed latch: %u nvdrv commits", nvdrv.get_nb_commits());
+    FZ_EXPECT(shows(ctrl, b), "cmu not shown after a missed latch");
+    ctrl.is_latch_stuck = false;
+
+    // The state after the fallback is trusted again
+    ctrl.writes.clear();
+    backend.commit(true, a);
+    FZ_EXPECT(nvdrv.get_nb_commits() == 4, "%u nvdrv commits", nvdrv.get_nb_commits());
+    FZ_EXPECT(shows(ctrl, a), "cmu not shown");
+}
+
+} // namespace
+
+int main() {
+    check_sequence();
+    check_fallbacks();
+
+    return test::result("register_backend");
+}
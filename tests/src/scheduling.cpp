@@ -0,0 +1,515 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <cstring>
+
+#include <common.hpp>
+
+#include "context.hpp"
+#include "nvdisp.hpp"
+#include "profile.hpp"
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+constexpr std::uint64_t second = 1'000'000'000;
+constexpr Timestamp day = 24*60*60;
+
+// Last cmu submitted to nvdrv
+Cmu committed;
+
+// Csc and enable bit of the internal display as programmed by nvdrv, read back by the watchdog while clocked
+void program_registers(const Cmu &cmu) {
+    for (std::size_t i = 0; i < 9; ++i)
+        *test::mmio(DISP_IO_BASE + DC_COM_CMU_CSC_KRR + i * sizeof(u32)) = static_cast<std::uint16_t>((&cmu.krr)[i]) & QS18::BitMask;
+    *test::mmio(DISP_IO_BASE + DC_DISP_DISP_COLOR_CONTROL) = cmu.enable ? CMU_ENABLE : 0;
+}
+
+Result capture_cmu(u32, u32 request, void *argp) {
+    if (request == _NV_IOWR(2, 14, Cmu)) {
+        std::memcpy(static_cast<void *>(&committed), argp, sizeof(Cmu));
+        program_registers(committed);
+    }
+    return 0;
+}
+
+bool operator==(const Cmu &lhs, const Cmu &rhs) {
+    return !std::memcmp(&lhs, &rhs, sizeof(Cmu));
+}
+
+void check_next_transition_event() {
+    constexpr Timestamp dusk = 18*60*60, dawn = 6*60*60, length = 30*60;
+    std::array<Schedule::Window, 2> windows = {{ { dawn, dawn + length }, { dusk, dusk + length } }};
+    std::array<const TransitionPlan *, 2> none = {};
+
+    // Outside of windows, the next boundary, possibly on the next day
+    FZ_EXPECT(next_transition_event(windows, none, 0) == dawn, "%lu", next_transition_event(windows, none, 0));
+    FZ_EXPECT(next_transition_event(windows, none, dawn - 1) == 1, "%lu", next_transition_event(windows, none, dawn - 1));
+    FZ_EXPECT(next_transition_event(windows, none, dawn + length) == dusk - dawn - length, "%lu",
+        next_transition_event(windows, none, dawn + length));
+    FZ_EXPECT(next_transition_event(windows, none, day - 1) == dawn + 1, "%lu", next_transition_event(windows, none, day - 1));
+
+    // Without a plan, every second of a window
+    FZ_EXPECT(next_transition_event(windows, none, dusk) == 1, "%lu", next_transition_event(windows, none, dusk));
+
+    // With a plan, the next change after ts, or its frontier
+    TransitionPlan plan = { .is_valid = true, .start = dusk + 1, .end = dusk + length, .frontier = dusk + 61, .nb_changes = 2 };
+    plan.changes[0] = 4, plan.changes[1] = 20;
+    std::array<const TransitionPlan *, 2> plans = { nullptr, &plan };
+
+    FZ_EXPECT(next_transition_event(windows, plans, dusk) == 5, "%lu", next_transition_event(windows, plans, dusk));
+    FZ_EXPECT(next_transition_event(windows, plans, dusk + 5) == 16, "%lu", next_transition_event(windows, plans, dusk + 5));
+    FZ_EXPECT(next_transition_event(windows, plans, dusk + 21) == 40, "%lu", next_transition_event(windows, plans, dusk + 21));
+
+    plan.changes[0] = 0;
+    FZ_EXPECT(next_transition_event(windows, plans, dusk) == 1, "%lu", next_transition_event(windows, plans, dusk));
+
+    // Plans not covering the next second, or overflowed, fall back to every second
+    FZ_EXPECT(next_transition_event(windows, plans, dusk + 60) == 1, "%lu", next_transition_event(windows, plans, dusk + 60));
+    plan.is_overflowed = true;
+    FZ_EXPECT(next_transition_event(windows, plans, dusk + 5) == 1, "%lu", next_transition_event(windows, plans, dusk + 5));
+}
+
+// Periods follow the segments of the schedule, with the weight of the night settings in what it shows
+void check_periods() {
+    auto night = Config::default_settings;
+    night.temperature = 2700;
+
+    FizeauProfile profile = {
+        .day_settings = Config::default_settings, .night_settings = night,
+        .dusk_begin = { 18,  0, 0 }, .dusk_end = { 18, 30, 0 },
+        .dawn_begin = {  6,  0, 0 }, .dawn_end = {  6, 30, 0 },
+    };
+
+    struct Case {
+        Timestamp ts;
+        FizeauPeriod period;
+        float factor;
+    };
+
+    auto check = [](const FizeauProfile &profile, std::span<const Case> cases) {
+        Schedule schedule;
+        schedule.set(profile);
+        for (auto &c: cases) {
+            auto [period, factor] = schedule.get_period(schedule.sample(c.ts));
+            FZ_EXPECT((period == c.period) && (std::abs(factor - c.factor) < 1e-6f), "at %lu: period %d, factor %f",
+                c.ts, period, factor);
+        }
+    };
+
+    std::array cases = {
+        Case{ 12*60*60,         FizeauPeriod_Day,   0.0f  },
+        Case{ 18*60*60,         FizeauPeriod_Dusk,  0.0f  },
+        Case{ 18*60*60 + 15*60, FizeauPeriod_Dusk,  0.5f  },
+        Case{ 18*60*60 + 30*60, FizeauPeriod_Night, 1.0f  },
+        Case{  3*60*60,         FizeauPeriod_Night, 1.0f  },
+        Case{  6*60*60 + 20*60, FizeauPeriod_Dawn,  1.0f / 3.0f },
+        Case{  6*60*60 + 30*60, FizeauPeriod_Day,   0.0f  },
+    };
+    check(profile, cases);
+
+    // Periods change at the keyframes, which are waited on
+    Schedule schedule;
+    schedule.set(profile);
+    FZ_EXPECT(schedule.next_keyframe(12*60*60) == 6*60*60, "%lu", schedule.next_keyframe(12*60*60));
+    FZ_EXPECT(schedule.next_keyframe(18*60*60) == 30*60, "%lu", schedule.next_keyframe(18*60*60));
+    FZ_EXPECT(schedule.next_keyframe(23*60*60) == 7*60*60, "%lu", schedule.next_keyframe(23*60*60));
+
+    // Identical settings are held, at the weight of the keyframe starting the segment
+    profile.night_settings = profile.day_settings;
+    std::array held = {
+        Case{ 18*60*60 + 15*60, FizeauPeriod_Dusk,  0.0f  },
+        Case{  6*60*60 + 15*60, FizeauPeriod_Dawn,  1.0f  },
+    };
+    check(profile, held);
+}
+
+// Custom keyframes replace the dusk and dawn windows, in the order of their times. The warmer ones stand for the night
+void check_keyframes() {
+    auto keyframe = [](Time time, Temperature temperature) {
+        auto settings = Config::default_settings;
+        settings.temperature = temperature;
+        return FizeauKeyframe{ time, settings };
+    };
+
+    FizeauProfile profile = {
+        .day_settings = Config::default_settings, .night_settings = Config::default_settings,
+        .dusk_begin = { 18,  0, 0 }, .dusk_end = { 18, 30, 0 },
+        .dawn_begin = {  6,  0, 0 }, .dawn_end = {  6, 30, 0 },
+        .nb_keyframes = 4,
+        .keyframes = {
+            keyframe({ 21, 0, 0 }, 3000), keyframe({  7, 0, 0 }, 6500),
+            keyframe({ 23, 0, 0 }, 3000), keyframe({ 12, 0, 0 }, 5500),
+        },
+    };
+
+    Schedule schedule;
+    schedule.set(profile);
+
+    struct Case {
+        Timestamp ts;
+        FizeauPeriod period;
+        float factor;
+        Temperature temperature;
+    };
+
+    std::array cases = {
+        Case{  9*60*60 + 30*60, FizeauPeriod_Day,   0.0f, 6000 },
+        Case{ 16*60*60 + 30*60, FizeauPeriod_Dusk,  0.5f, 4250 },
+        Case{ 22*60*60,         FizeauPeriod_Night, 1.0f, 3000 },
+        Case{  3*60*60,         FizeauPeriod_Dawn,  0.5f, 4750 },
+    };
+
+    for (auto &c: cases) {
+        auto sample = schedule.sample(c.ts);
+        auto [period, factor] = schedule.get_period(sample);
+        FZ_EXPECT((period == c.period) && (std::abs(factor - c.factor) < 1e-6f), "at %lu: period %d, factor %f",
+            c.ts, period, factor);
+        FZ_EXPECT(sample.settings.temperature == c.temperature, "at %lu: temperature %u", c.ts, sample.settings.temperature);
+    }
+
+    // Segments holding the settings have no window, the one crossing midnight is split
+    FZ_EXPECT(schedule.get_windows().size() == 4, "%zu windows", schedule.get_windows().size());
+    FZ_EXPECT(schedule.next_keyframe(22*60*60) == 60*60, "%lu", schedule.next_keyframe(22*60*60));
+}
+
+void check_next_dimming_event() {
+    FZ_EXPECT(next_dimming_event(0, 100 * second, false) == UINT64_MAX, "disabled timeout");
+    FZ_EXPECT(next_dimming_event(30, 100 * second, true) == UINT64_MAX, "already dimming");
+
+    // Dims once the idle time in whole seconds exceeds the timeout
+    FZ_EXPECT(next_dimming_event(30, 10 * second + 5, false) == 21 * second - 5, "%lu",
+        next_dimming_event(30, 10 * second + 5, false));
+    FZ_EXPECT(next_dimming_event(30, 31 * second, false) == 0, "%lu", next_dimming_event(30, 31 * second, false));
+
+    // The deadline is where the decision of the commits turns
+    for (auto idle: { 29 * second, 30 * second, 31 * second - 1, 31 * second, 32 * second }) {
+        FZ_EXPECT(is_dimming_due(30, idle) == (next_dimming_event(30, idle, false) == 0), "idle for %luns", idle);
+        FZ_EXPECT(!is_dimming_due(0, idle), "disabled timeout, idle for %luns", idle);
+    }
+}
+
+// Commits of a dusk transition land between the dimming deadlines, and must take the same decision as the deadlines.
+// Input while undimmed isn't waited on, the commits must still see it
+void check_dimming_commits() {
+    auto night = Config::default_settings;
+    night.temperature = 2700;
+
+    FizeauProfile profile = {
+        .day_settings = Config::default_settings, .night_settings = night,
+        .components = Component_All, .filter = Component_None,
+        .dusk_begin = { 18,  0, 0 }, .dusk_end = { 18, 30, 0 },
+        .dawn_begin = {  6,  0, 0 }, .dawn_end = {  6, 30, 0 },
+        .dimming_timeout = { 0, 0, 30 },
+    };
+
+    test::wall_time = 18*60*60, test::system_tick = 0, test::last_input_tick = 0;
+
+    Context context;
+    DisplayController disp;
+    ProfileManager pm(context, disp);
+
+    Clock::initialize();
+    disp.initialize();
+    pm.initialize();
+
+    context.shared.write([&](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+        s.profiles[FizeauProfileId_Profile1] = profile;
+    });
+    pm.dispatch(-1);
+
+    auto commits = pm.get_commit_stats().nb_cmu_issued;
+    while (!pm.get_is_dimming() && (test::system_tick < 60 * second)) {
+        test::system_tick = std::max(test::system_tick, pm.get_deadline());
+        pm.dispatch(-1);
+
+        if (test::system_tick < 20 * second)
+            test::last_input_tick = test::system_tick;
+    }
+
+    FZ_EXPECT(pm.get_commit_stats().nb_cmu_issued - commits > 5, "%u commits", pm.get_commit_stats().nb_cmu_issued - commits);
+    FZ_EXPECT(pm.get_is_dimming(), "not dimmed after %lums", test::system_tick / 1'000'000);
+    FZ_EXPECT(test::system_tick - test::last_input_tick >= 31 * second, "dimmed after %lums idle",
+        (test::system_tick - test::last_input_tick) / 1'000'000);
+
+    pm.finalize();
+}
+
+// Keyframes of a profile modified in a burst, eg. by a slider, are only cached once the burst settles
+void check_lazy_precompute() {
+    auto night = Config::default_settings;
+    night.temperature = 2700;
+
+    FizeauProfile profile = {
+        .day_settings = Config::default_settings, .night_settings = night,
+        .components = Component_All, .filter = Component_None,
+        .dusk_begin = { 18,  0, 0 }, .dusk_end = { 18, 30, 0 },
+        .dawn_begin = {  6,  0, 0 }, .dawn_end = {  6, 30, 0 },
+    };
+
+    test::wall_time = 12*60*60, test::system_tick = 0, test::last_input_tick = 0;
+
+    Context context;
+    DisplayController disp;
+    ProfileManager pm(context, disp);
+
+    Clock::initialize();
+    disp.initialize();
+    pm.initialize();
+
+    context.shared.write([&](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+        s.profiles[FizeauProfileId_Profile1] = profile;
+    });
+    pm.dispatch(-1);
+
+    // Night settings modified during the day, every frame for one second
+    auto misses = disp.get_cmu_cache().get_misses();
+    for (int i = 0; i < 60; ++i) {
+        context.shared.write([&](ContextSnapshot &s) { s.profiles[FizeauProfileId_Profile1].night_settings.temperature = 2000 + i * 10; });
+        pm.modify_fields(FizeauProfileId_Profile1, FizeauProfileField_NightTemperature);
+        pm.dispatch(-1);
+        test::system_tick += 16'666'667;
+    }
+    FZ_EXPECT(disp.get_cmu_cache().get_misses() == misses, "%u cmus calculated during the burst",
+        disp.get_cmu_cache().get_misses() - misses);
+
+    test::system_tick = pm.get_deadline();
+    pm.dispatch(-1);
+    FZ_EXPECT(disp.get_cmu_cache().get_misses() == misses + 1, "%u cmus calculated after the burst",
+        disp.get_cmu_cache().get_misses() - misses);
+
+    pm.finalize();
+}
+
+// Previews are committed without going through the cache, which keeps the keyframes of the profile
+void check_previews() {
+    FizeauProfile profile = {
+        .day_settings = Config::default_settings, .night_settings = Config::default_settings,
+        .components = Component_All, .filter = Component_None,
+    };
+
+    test::wall_time = 12*60*60, test::system_tick = 0, test::last_input_tick = 0;
+
+    Context context;
+    DisplayController disp, ref;
+    ProfileManager pm(context, disp);
+
+    Clock::initialize();
+    disp.initialize();
+    ref.initialize();
+    pm.initialize();
+
+    context.shared.write([&](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+        s.profiles[FizeauProfileId_Profile1] = profile;
+    });
+    pm.dispatch(-1);
+
+    DisplayController::CmuShadow shadow;
+    DisplayController::CmuStages stages;
+    auto hits = disp.get_cmu_cache().get_hits(), misses = disp.get_cmu_cache().get_misses();
+
+    for (int i = 0; i < 20; ++i) {
+        auto settings = Config::default_settings;
+        settings.temperature = 2000 + i * 100;
+
+        pm.set_preview(settings, second, test::system_tick);
+        auto shown = committed;
+
+        ref.invalidate_committed_state(false);
+        ref.apply_color_profile(false, settings, Component_All, Component_None, shadow, stages);
+        FZ_EXPECT(shown == committed, "preview at %uK differs from the reference", settings.temperature);
+    }
+
+    FZ_EXPECT((disp.get_cmu_cache().get_hits() == hits) && (disp.get_cmu_cache().get_misses() == misses),
+        "%u cache hits, %u misses for the previews", disp.get_cmu_cache().get_hits() - hits, disp.get_cmu_cache().get_misses() - misses);
+
+    // The revert finds the cmu of the profile in the cache
+    pm.end_preview();
+    pm.dispatch(-1);
+    FZ_EXPECT(disp.get_cmu_cache().get_misses() == misses, "%u cache misses for the revert", disp.get_cmu_cache().get_misses() - misses);
+
+    pm.finalize();
+}
+
+// Each client session gets its own state event, so that a client consuming a change doesn't hide it from the others
+void check_state_events() {
+    test::wall_time = 12*60*60, test::system_tick = 0, test::last_input_tick = 0;
+
+    Context context;
+    DisplayController disp;
+    ProfileManager pm(context, disp);
+
+    Clock::initialize();
+    disp.initialize();
+    pm.initialize();
+
+    constexpr Handle app = 0x100, overlay = 0x101, other = 0x102;
+    Handle first = INVALID_HANDLE, second = INVALID_HANDLE, again = INVALID_HANDLE, third = INVALID_HANDLE;
+    FZ_EXPECT(R_SUCCEEDED(pm.get_state_event(app, first)) && R_SUCCEEDED(pm.get_state_event(overlay, second)) &&
+        (first != second), "events %#x and %#x", first, second);
+    FZ_EXPECT(R_SUCCEEDED(pm.get_state_event(app, again)) && (again == first), "event %#x requested again", again);
+    FZ_EXPECT(R_FAILED(pm.get_state_event(other, third)), "more events than sessions");
+
+    context.shared.write([&](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+    });
+    pm.dispatch(-1);
+    FZ_EXPECT(test::is_signaled(first) && test::is_signaled(second), "change not signaled to both sessions");
+
+    // Cleared by the wait of the first client
+    Event event = { first, first, true };
+    eventClear(&event);
+    FZ_EXPECT(!test::is_signaled(first) && test::is_signaled(second), "the change was consumed for both sessions");
+
+    // Closed sessions free their event
+    pm.release_state_event(app);
+    FZ_EXPECT(R_SUCCEEDED(pm.get_state_event(other, third)), "event of a closed session not released");
+
+    pm.finalize();
+}
+
+struct Day {
+    std::size_t wakeups, checks, resets, commits;
+};
+
+// A day with a 30-minute 6500K -> 2700K dusk and dawn, with the reactor only woken at its deadlines.
+// The committed cmu must be the one of the current second at every second, without a wakeup at every second.
+// A clocked display also gets its registers read back by the watchdog
+Day simulate_day(FizeauTransitionMode mode, bool is_clocked) {
+    auto night = Config::default_settings;
+    night.temperature = 2700;
+
+    FizeauProfile profile = {
+        .day_settings = Config::default_settings, .night_settings = night,
+        .components = Component_All, .filter = Component_None,
+        .dusk_begin = { 18,  0, 0 }, .dusk_end = { 18, 30, 0 },
+        .dawn_begin = {  6,  0, 0 }, .dawn_end = {  6, 30, 0 },
+        .transition_mode = mode,
+    };
+
+    test::wall_time = 0, test::system_tick = 0, test::last_input_tick = 0;
+
+    Context context;
+    DisplayController disp, ref;
+    ProfileManager pm(context, disp);
+
+    Clock::initialize();
+    disp.initialize();
+    ref.initialize();
+    pm.initialize();
+
+    *test::mmio(CLOCK_IO_BASE + CLK_RST_CONTROLLER_CLK_OUT_ENB_L) = is_clocked ? CLK_ENB_DISP1 : 0;
+
+    context.shared.write([&](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+        s.profiles[FizeauProfileId_Profile1] = profile;
+    });
+
+    Schedule schedule;
+    schedule.set(profile);
+
+    DisplayController::CmuShadow shadow;
+    DisplayController::CmuStages stages;
+    auto reference = [&](Timestamp ts) {
+        auto sample = schedule.sample(ts);
+        ref.invalidate_committed_state(false);
+        if (sample.from && (mode == FizeauTransitionMode_Cmu)) {
+            FizeauSettings from = *sample.from, to = *sample.to;
+            ref.apply_interpolated_color_profile(false, from, to, sample.factor, Component_All, Component_None, shadow, stages);
+        } else {
+            ref.apply_color_profile(false, sample.settings, Component_All, Component_None, shadow, stages);
+        }
+        return committed;
+    };
+
+    Day result = {};
+    Cmu shown = {};
+    Timestamp last = 0;
+
+    for (std::uint64_t deadline; (deadline = pm.get_deadline()) < day * second; ) {
+        test::system_tick = std::max(test::system_tick, deadline);
+        auto ts = test::system_tick / second;
+
+        // Seconds slept through must not have changed the cmu
+        for (auto s = last + 1; (result.wakeups > 0) && (s < ts); ++s)
+            FZ_EXPECT(reference(s) == shown, "mode %d: the cmu changed at %lu, while sleeping until %lu", mode, s, ts);
+
+        // The references went through nvdrv too
+        committed = shown;
+        program_registers(shown);
+        pm.dispatch(-1);
+        shown = committed;
+
+        ++result.wakeups, last = ts;
+        if (result.wakeups > 1)
+            FZ_EXPECT(reference(ts) == shown, "mode %d: the cmu shown at %lu differs from the reference", mode, ts);
+    }
+
+    result.checks  = pm.get_watchdog_stats().nb_checks;
+    result.resets  = pm.get_watchdog_stats().nb_resets;
+    result.commits = pm.get_commit_stats().nb_cmu_issued;
+
+    pm.finalize();
+    return result;
+}
+
+} // namespace
+
+int main() {
+    test::nv_ioctl = capture_cmu;
+
+    check_next_transition_event();
+    check_periods();
+    check_keyframes();
+    check_next_dimming_event();
+    check_dimming_commits();
+    check_lazy_precompute();
+    check_previews();
+    check_state_events();
+
+    // A 100ms timer wakes up 864000 times a day, and so did the checks of the registers.
+    // On a clocked display, commits are verified without restarting a burst, so checks stay at about one per second
+    for (bool is_clocked: { false, true }) {
+        for (auto mode: { FizeauTransitionMode_Settings, FizeauTransitionMode_Cmu }) {
+            auto result = simulate_day(mode, is_clocked);
+            std::printf("%-8s %-7s %6zu wakeups over a day, %6zu watchdog checks, %4zu commits\n",
+                mode == FizeauTransitionMode_Cmu ? "cmu" : "settings", is_clocked ? "clocked" : "gated",
+                result.wakeups, result.checks, result.commits);
+
+            // The first check on a clocked display precedes the first commit, and finds the cmu of nvdrv
+            FZ_EXPECT(result.resets <= is_clocked, "mode %d: %zu resets detected", mode, result.resets);
+            if (is_clocked)
+                FZ_EXPECT(result.checks <= day, "mode %d: %zu watchdog checks", mode, result.checks);
+            else
+                FZ_EXPECT(result.checks == 0, "mode %d: %zu watchdog checks on a gated display", mode, result.checks);
+        }
+    }
+
+    return test::result("scheduling");
+}
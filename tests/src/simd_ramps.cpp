@@ -0,0 +1,157 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <cstring>
+#include <array>
+#include <bit>
+
+#include <common.hpp>
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+using V = simd::Vec<float>;
+
+// The original gamma_ramp, with the conversion of negative values spelled out as the aarch64 one (fcvtzu saturates to 0)
+std::size_t nb_negative = 0;
+
+void original_ramp(float (*func)(float, Gamma), std::uint16_t *array, std::size_t size, Gamma gamma, std::size_t nb_bits,
+        float lo, float hi, float off) {
+    float step = (hi - lo) / (size - 1), cur = lo;
+    std::uint16_t shift = (1 << nb_bits) - 1, mask = (1 << (nb_bits + 1)) - 1;
+
+    for (std::size_t i = 0; i < size; ++i, cur += step) {
+        auto v = std::round(func(std::clamp(cur + off, 0.0f, 1.0f), gamma) * shift);
+        nb_negative += v < 0.0f;
+        array[i] = static_cast<std::uint16_t>(std::max(v, 0.0f)) & mask;
+    }
+}
+
+// gamma_ramp goes through impl::quantize, and must match the original conversion on the console
+void check_reference() {
+    std::array<std::uint16_t, 512> actual, expected;
+
+    for (int i = 0; i <= 500; ++i) {
+        Gamma gamma = i * 0.01f;
+        for (int j = 0; j <= 20; ++j) {
+            auto off = (1.0f - contrast_slant(j * 0.1f)) / 2.0f;
+
+            for (auto func: { degamma, regamma }) {
+                for (auto nb_bits: { 8, 12 }) {
+                    gamma_ramp(func, actual.data(), actual.size(), gamma, nb_bits, 0.0f, 0.125f, off);
+                    original_ramp(func, expected.data(), expected.size(), gamma, nb_bits, 0.0f, 0.125f, off);
+                    FZ_EXPECT(actual == expected, "%s, gamma %.2f offset %f, %d-bit",
+                        func == degamma ? "degamma" : "regamma", gamma, off, nb_bits);
+                }
+            }
+        }
+    }
+
+    FZ_EXPECT(nb_negative > 0, "no negative value was clamped");
+}
+
+// Vector and scalar evaluations of the kernels must give the same bits, lane per lane
+void check_pow() {
+    std::uint32_t state = 0x12345678;
+    auto next = [&state] {
+        state ^= state << 13, state ^= state >> 17, state ^= state << 5;
+        return static_cast<float>(state) / static_cast<float>(UINT32_MAX);
+    };
+
+    for (int i = 0; i < 1'000'000; ++i) {
+        V x;
+        for (std::size_t j = 0; j < simd::lanes_of<V>; ++j)
+            x[j] = next();
+        float y = next() * 8.0f;
+
+        auto res = fastmath::pow(x, y);
+        for (std::size_t j = 0; j < simd::lanes_of<V>; ++j) {
+            auto expected = fastmath::pow(x[j], y);
+            FZ_EXPECT(std::bit_cast<std::uint32_t>(res[j]) == std::bit_cast<std::uint32_t>(expected),
+                "pow(%a, %a): vector %a, scalar %a", x[j], y, res[j], expected);
+        }
+    }
+}
+
+// The ramps take the vector loop when the function accepts vectors, wrapping it in a scalar lambda forces the scalar loop
+void check_ramps() {
+    std::array<std::uint16_t, 448> vector, scalar;
+    std::array<float, 448> samples;
+
+    for (int i = 1; i <= 500; ++i) {
+        Gamma gamma = i * 0.01f;
+        for (int j = 0; j <= 20; ++j) {
+            auto off = (1.0f - contrast_slant(j * 0.1f)) / 2.0f;
+
+            auto kernel = impl::regamma_kernel(gamma);
+            impl::ramp(kernel, vector.data(), vector.size(), 8, 0.125f, 1.0f, off);
+            impl::ramp([&kernel](float x) { return kernel(x); }, scalar.data(), scalar.size(), 8, 0.125f, 1.0f, off);
+            FZ_EXPECT(vector == scalar, "regamma ramp, gamma %.2f offset %f", gamma, off);
+
+            auto top = regamma_samples(samples.data(), samples.size(), gamma, 0.125f, 1.0f, off);
+            auto luma_range = impl::LumaRange(top, -0.3f, { 16.0f / 255.0f, 235.0f / 255.0f });
+            luma_range_ramp(samples.data(), vector.data(), vector.size(), 8, top, -0.3f, { 16.0f / 255.0f, 235.0f / 255.0f });
+            for (std::size_t k = 0; k < scalar.size(); ++k)
+                impl::quantize(scalar.data(), k, luma_range(samples[k]), 8);
+            FZ_EXPECT(vector == scalar, "luma/range ramp, gamma %.2f offset %f", gamma, off);
+        }
+    }
+}
+
+// Constant evaluation only takes the scalar loop
+template <Gamma G>
+void check_constexpr() {
+    constexpr auto degamma_lut = [] {
+        std::array<std::uint16_t, 256> lut = {};
+        degamma_ramp(lut.data(), lut.size(), G, 12);
+        return lut;
+    }();
+
+    constexpr auto regamma_lut = [] {
+        std::array<std::uint16_t, 448> lut = {};
+        regamma_ramp(lut.data(), lut.size(), G, 8, 0.125f, 1.0f, 0.0f);
+        return lut;
+    }();
+
+    std::array<std::uint16_t, 256> degamma_runtime;
+    std::array<std::uint16_t, 448> regamma_runtime;
+    degamma_ramp(degamma_runtime.data(), degamma_runtime.size(), G, 12);
+    regamma_ramp(regamma_runtime.data(), regamma_runtime.size(), G, 8, 0.125f, 1.0f, 0.0f);
+
+    FZ_EXPECT(degamma_lut == degamma_runtime, "constexpr degamma ramp, gamma %.2f", G);
+    FZ_EXPECT(regamma_lut == regamma_runtime, "constexpr regamma ramp, gamma %.2f", G);
+}
+
+} // namespace
+
+int main() {
+    check_reference();
+    check_pow();
+    check_ramps();
+
+    check_constexpr<0.5f>();
+    check_constexpr<1.0f>();
+    check_constexpr<DEFAULT_GAMMA>();
+    check_constexpr<4.2f>();
+
+    std::printf("simd_ramps: %zu lanes, %zu negative entries clamped\n", simd::lanes_of<V>, nb_negative);
+    return test::result("simd_ramps");
+}
@@ -0,0 +1,230 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <common.hpp>
+
+#include "nvdisp.hpp"
+#include "schedule.hpp"
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+DisplayController disp;
+DisplayController::CmuShadow shadow;
+DisplayController::CmuStages stages;
+
+// Last cmu submitted to nvdrv
+Cmu committed;
+
+Result capture_cmu(u32, u32 request, void *argp) {
+    if (request == _NV_IOWR(2, 14, Cmu))
+        std::memcpy(static_cast<void *>(&committed), argp, sizeof(Cmu));
+    return 0;
+}
+
+// Software model of the cmu: LUT1 to 12-bit linear, csc in QS1.8, then LUT2 in two segments
+std::array<int, 3> run_cmu(const Cmu &cmu, std::array<int, 3> rgb) {
+    std::array<float, 3> lin;
+    for (std::size_t i = 0; i < lin.size(); ++i)
+        lin[i] = cmu.lut_1[rgb[i]];
+
+    std::array<int, 3> out;
+    for (std::size_t i = 0; i < out.size(); ++i) {
+        float v = 0.0f;
+        for (std::size_t j = 0; j < 3; ++j)
+            v += static_cast<std::int16_t>((&cmu.krr)[3 * i + j]) / 256.0f * lin[j];
+
+        auto x = std::clamp(v, 0.0f, 4095.0f) / 4095.0f;
+        auto idx = (x < 0.125f) ? std::lround(x / 0.125f * 511.0f) : 512 + std::lround((x - 0.125f) / 0.875f * 447.0f);
+        out[i] = cmu.lut_2[idx];
+    }
+
+    return out;
+}
+
+Cmu commit_cmu(const Schedule::Sample &sample, FizeauTransitionMode mode) {
+    // Bypass the skipping of identical commits, so that each call gets captured
+    disp.invalidate_committed_state(false);
+
+    FizeauSettings settings = sample.settings, from = *sample.from, to = *sample.to;
+    if (mode == FizeauTransitionMode_Cmu)
+        disp.apply_interpolated_color_profile(false, from, to, sample.factor, Component_All, Component_None, shadow, stages);
+    else
+        disp.apply_color_profile(false, settings, Component_All, Component_None, shadow, stages);
+
+    return committed;
+}
+
+struct Difference {
+    double mean;
+    int max;
+    double endpoints;
+};
+
+// Runs a 16^3 grid of colors through the cmus of both modes, at 101 steps over a dusk transition.
+// Returns the differences in 8-bit output levels
+Difference measure(const FizeauSettings &day, const FizeauSettings &night) {
+    FizeauProfile profile = {
+        .day_settings = day, .night_settings = night,
+        .components = Component_All, .filter = Component_None,
+        .dusk_begin = { 18, 0, 0 }, .dusk_end = { 19, 0, 0 },
+        .dawn_begin = {  6, 0, 0 }, .dawn_end = {  7, 0, 0 },
+    };
+
+    Schedule schedule;
+    schedule.set(profile);
+
+    double total = 0.0, endpoints = 0.0;
+    int max = 0;
+    std::size_t count = 0;
+
+    for (int step = 0; step <= 100; ++step) {
+        auto sample = schedule.sample(to_timestamp(profile.dusk_begin) + step * 36);
+        if (!sample.from) {
+            // The end of the window is sampled as the night settings
+            sample.from = &profile.day_settings, sample.to = &profile.night_settings, sample.factor = 1.0f;
+        }
+
+        auto by_settings = commit_cmu(sample, FizeauTransitionMode_Settings);
+        auto by_cmu      = commit_cmu(sample, FizeauTransitionMode_Cmu);
+
+        for (int r = 0; r < 256; r += 17) {
+            for (int g = 0; g < 256; g += 17) {
+                for (int b = 0; b < 256; b += 17) {
+                    auto lhs = run_cmu(by_settings, { r, g, b }), rhs = run_cmu(by_cmu, { r, g, b });
+                    for (std::size_t i = 0; i < lhs.size(); ++i) {
+                        auto diff = std::abs(lhs[i] - rhs[i]);
+                        total += diff, max = std::max(max, diff), ++count;
+                        if ((step == 0) || (step == 100))
+                            endpoints += diff;
+                    }
+                }
+            }
+        }
+    }
+
+    return { total / count, max, endpoints };
+}
+
+// A dimming fade during a cmu transition only fills the cache with the four endpoints, and ends on the cmus undimmed
+// and fully dimmed
+void check_dimming_fade() {
+    auto day = Config::default_settings, night = Config::default_settings;
+    night.temperature = 2700, night.luminance = -0.2f;
+    constexpr Luminance luma = -0.6f;
+    auto dimmed_from = day, dimmed_to = night;
+    dimmed_from.luminance = dimmed_to.luminance = luma;
+
+    auto commit = [](FizeauSettings from, FizeauSettings to, float dim_level) {
+        disp.invalidate_committed_state(false);
+        if (dim_level < 0.0f)
+            disp.apply_interpolated_color_profile(false, from, to, 0.3f, Component_All, Component_None, shadow, stages);
+        else
+            disp.apply_interpolated_dimming_step(false, from, to, 0.3f, luma, dim_level,
+                Component_All, Component_None, shadow, stages);
+        return committed;
+    };
+
+    auto undimmed = commit(day, night, -1.0f), dimmed = commit(dimmed_from, dimmed_to, -1.0f);
+    auto misses = disp.get_cmu_cache().get_misses();
+
+    auto start = commit(day, night, 0.0f);
+    FZ_EXPECT(!std::memcmp(&start, &undimmed, sizeof(Cmu)), "the fade does not start on the undimmed cmu");
+    for (int i = 1; i < 18; ++i)
+        commit(day, night, i / 18.0f);
+    auto end = commit(day, night, 1.0f);
+    FZ_EXPECT(!std::memcmp(&end, &dimmed, sizeof(Cmu)), "the fade does not end on the dimmed cmu");
+
+    FZ_EXPECT(disp.get_cmu_cache().get_misses() == misses, "%u cache misses during the fade",
+        disp.get_cmu_cache().get_misses() - misses);
+}
+
+// Settings within a step of the key share a cache entry, the defaults are kept exact
+void check_quantized_keys() {
+    auto settings = Config::default_settings;
+    settings.gamma = 2.2f, settings.saturation = 0.8f;
+    settings = CmuCache::quantize(settings);
+
+    auto commit = [](FizeauSettings settings) {
+        disp.invalidate_committed_state(false);
+        disp.apply_color_profile(false, settings, Component_All, Component_None, shadow, stages);
+        return committed;
+    };
+
+    auto first = commit(settings);
+    auto misses = disp.get_cmu_cache().get_misses();
+
+    // Slider positions less than half a step away
+    for (float delta: { 1e-5f, -1e-4f, 3e-4f }) {
+        auto nearby = settings;
+        nearby.gamma += delta, nearby.saturation -= delta;
+        auto cmu = commit(nearby);
+        FZ_EXPECT(!std::memcmp(&cmu, &first, sizeof(Cmu)), "delta %g: different cmu", delta);
+    }
+    FZ_EXPECT(disp.get_cmu_cache().get_misses() == misses, "%u cache misses", disp.get_cmu_cache().get_misses() - misses);
+
+    FZ_EXPECT(CmuCache::quantize(Config::default_settings) == Config::default_settings, "the defaults are not exact");
+}
+
+} // namespace
+
+// Difference between the settings and cmu transition modes, which is the cost of the cheaper cmu lerp.
+// Both modes must agree exactly at the endpoints of the transition
+int main() {
+    fz::test::nv_ioctl = capture_cmu;
+    disp.initialize();
+
+    auto with = [](auto &&func) {
+        auto settings = Config::default_settings;
+        func(settings);
+        return settings;
+    };
+
+    struct Case {
+        const char *name;
+        FizeauSettings day, night;
+    };
+
+    std::array cases = {
+        Case{ "6500K -> 2700K", Config::default_settings, with([](auto &s) { s.temperature = 2700; }) },
+        Case{ "4500K -> 3000K, contrast 1 -> 0.8",
+            with([](auto &s) { s.temperature = 4500; }), with([](auto &s) { s.temperature = 3000, s.contrast = 0.8f; }) },
+        Case{ "6500K -> 1900K, luma -0.3, gamma 2.0",
+            Config::default_settings, with([](auto &s) { s.temperature = 1900, s.luminance = -0.3f, s.gamma = 2.0f; }) },
+        Case{ "saturation 1 -> 0.4", Config::default_settings, with([](auto &s) { s.saturation = 0.4f; }) },
+        Case{ "saturation 1 -> 0.4, hue 0 -> 0.15",
+            Config::default_settings, with([](auto &s) { s.saturation = 0.4f, s.hue = 0.15f; }) },
+    };
+
+    for (auto &c: cases) {
+        auto diff = measure(c.day, c.night);
+        std::printf("%-40s mean %.2f, max %d\n", c.name, diff.mean, diff.max);
+        FZ_EXPECT(diff.endpoints == 0.0, "%s: the modes differ at the endpoints", c.name);
+    }
+
+    check_dimming_fade();
+    check_quantized_keys();
+
+    return test::result("transition_modes");
+}
@@ -0,0 +1,186 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+
+#include <common.hpp>
+
+#include "context.hpp"
+#include "nvdisp.hpp"
+#include "profile.hpp"
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+constexpr std::uint64_t second = 1'000'000'000;
+
+// Last cmu submitted to nvdrv, by any display controller
+Cmu committed;
+
+Result capture_cmu(u32, u32 request, void *argp) {
+    if (request == _NV_IOWR(2, 14, Cmu))
+        std::memcpy(static_cast<void *>(&committed), argp, sizeof(Cmu));
+    return 0;
+}
+
+bool operator==(const Cmu &lhs, const Cmu &rhs) {
+    return !std::memcmp(&lhs, &rhs, sizeof(Cmu));
+}
+
+// next_change against a scan of every step
+void check_next_change() {
+    for (std::int32_t a: { 0, 1, 255, 256, -256, 1023, -37 }) {
+        for (std::int32_t b: { 0, 3, 256, -256, 1023, 700, -37 }) {
+            for (std::int32_t step = 0; step <= CmuLerp::One; step += 997) {
+                auto value = CmuLerp(0.0f);
+                auto next = CmuLerp::One + 1;
+                value.step = step;
+                for (auto s = step + 1; s <= CmuLerp::One; ++s) {
+                    auto lerp = CmuLerp(0.0f);
+                    lerp.step = s;
+                    if (lerp(a, b) != value(a, b)) {
+                        next = s;
+                        break;
+                    }
+                }
+
+                FZ_EXPECT(CmuLerp::next_change(a, b, step) == next, "lerp %d -> %d from step %d: %d, expected %d",
+                    a, b, step, CmuLerp::next_change(a, b, step), next);
+            }
+        }
+    }
+}
+
+struct Count {
+    std::size_t commits, reference;
+};
+
+// Runs the profile manager over a 30-minute dusk with a fake clock, and checks the committed cmu at each second against
+// the one of the previous behaviour, which recomputed it every second. Commits are counted within the window
+Count run(FizeauTransitionMode mode, bool is_dimmed) {
+    auto night = Config::default_settings;
+    night.temperature = 2700, night.gamma = 2.0f, night.luminance = -0.2f;
+
+    FizeauProfile profile = {
+        .day_settings = Config::default_settings, .night_settings = night,
+        .components = Component_All, .filter = Component_None,
+        .dusk_begin = { 18,  0, 0 }, .dusk_end = { 18, 30, 0 },
+        .dawn_begin = {  6,  0, 0 }, .dawn_end = {  7,  0, 0 },
+        .dimming_timeout = { 0, 0, static_cast<std::uint8_t>(is_dimmed) },
+        .transition_mode = mode,
+    };
+
+    // Start 10 minutes before the window, which leaves time for the dimming fade to end
+    constexpr Timestamp begin = 18*60*60, end = begin + 30*60, origin = begin - 10*60;
+    test::wall_time = origin, test::system_tick = 0, test::last_input_tick = 0;
+
+    Context context;
+    DisplayController disp, ref;
+    ProfileManager pm(context, disp);
+
+    Clock::initialize();
+    disp.initialize();
+    ref.initialize();
+    pm.initialize();
+
+    context.shared.write([&](ContextSnapshot &s) {
+        s.is_active = true;
+        s.internal_profile = FizeauProfileId_Profile1;
+        s.profiles[FizeauProfileId_Profile1] = profile;
+    });
+
+    // Cmu of each second, computed from scratch
+    DisplayController::CmuShadow shadow;
+    DisplayController::CmuStages stages;
+    auto reference = [&](Timestamp ts) {
+        Schedule schedule;
+        schedule.set(profile);
+        auto sample = schedule.sample(ts);
+
+        auto settings = sample.settings;
+        FizeauSettings from = sample.from ? *sample.from : settings, to = sample.to ? *sample.to : settings;
+        if (is_dimmed)
+            settings.luminance = from.luminance = to.luminance = dimmed_luma_internal;
+
+        ref.invalidate_committed_state(false);
+        if (sample.from && (mode == FizeauTransitionMode_Cmu))
+            ref.apply_interpolated_color_profile(false, from, to, sample.factor, Component_All, Component_None, shadow, stages);
+        else
+            ref.apply_color_profile(false, settings, Component_All, Component_None, shadow, stages);
+        return committed;
+    };
+
+    Count count = {};
+    Cmu shown = {}, expected = reference(begin - 1);
+    std::size_t commits = 0;
+
+    for (Timestamp ts = origin; ts <= end + 60; ++ts) {
+        test::system_tick = (ts - origin) * second + 1;
+
+        // Events are dispatched in order, up to the current time
+        for (int i = 0; (i < 1000) && (pm.get_deadline() <= test::system_tick); ++i) {
+            committed = shown;
+            pm.dispatch(-1);
+            shown = committed;
+        }
+
+        if (ts == begin)
+            commits = pm.get_commit_stats().nb_cmu_issued;
+
+        if (ts < begin)
+            continue;
+
+        auto now = (ts <= end) ? reference(ts) : expected;
+        FZ_EXPECT(shown == now, "mode %d%s: the cmu shown at %lu differs from the reference", mode, is_dimmed ? ", dimmed" : "", ts);
+
+        if ((ts > begin) && (ts <= end))
+            count.reference += !(now == expected);
+        expected = now;
+
+        if (ts == end)
+            count.commits = pm.get_commit_stats().nb_cmu_issued - commits;
+    }
+
+    pm.finalize();
+    return count;
+}
+
+} // namespace
+
+// The reactor only wakes up for the seconds where the committed cmu changes, and commits the same cmus as when
+// recomputing it every second
+int main() {
+    test::nv_ioctl = capture_cmu;
+
+    check_next_change();
+
+    for (auto mode: { FizeauTransitionMode_Settings, FizeauTransitionMode_Cmu }) {
+        for (bool is_dimmed: { false, true }) {
+            auto count = run(mode, is_dimmed);
+            std::printf("%-8s %-8s %4zu commits over 1800s, reference %4zu\n",
+                mode == FizeauTransitionMode_Cmu ? "cmu" : "settings", is_dimmed ? "dimmed" : "", count.commits,
+                count.reference);
+            FZ_EXPECT(count.commits == count.reference, "mode %d%s: %zu commits, expected %zu",
+                mode, is_dimmed ? ", dimmed" : "", count.commits, count.reference);
+        }
+    }
+
+    return test::result("transition_plans");
+}
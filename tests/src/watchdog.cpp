@@ -0,0 +1,108 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <common.hpp>
+
+#include "watchdog.hpp"
+
+#include "test.hpp"
+
+using namespace fz;
+
+namespace {
+
+constexpr std::uint64_t ms = 1'000'000;
+
+// Bursts check every frame, then back off up to the max interval
+void check_backoff() {
+    CmuWatchdog watchdog;
+    watchdog.arm(0);
+    FZ_EXPECT(watchdog.get_deadline() <= CmuWatchdog::MinInterval, "%lu", watchdog.get_deadline());
+
+    std::uint64_t now = 0;
+    while (watchdog.is_full_check(now)) {
+        now = watchdog.get_deadline();
+        watchdog.report(now, false);
+    }
+    FZ_EXPECT(watchdog.get_deadline() - now <= 2 * CmuWatchdog::MinInterval, "burst interval %lu", watchdog.get_deadline() - now);
+
+    for (int i = 0; i < 16; ++i)
+        now = watchdog.get_deadline(), watchdog.report(now, false);
+    FZ_EXPECT(watchdog.get_deadline() - now == CmuWatchdog::MaxInterval, "steady interval %lu", watchdog.get_deadline() - now);
+}
+
+// Skipped checks, while the display is gated, leave the statistics untouched
+void check_skip() {
+    CmuWatchdog watchdog;
+    watchdog.arm(0);
+    watchdog.report(100 * ms, false);
+
+    auto checks = watchdog.get_stats().nb_checks;
+    std::uint64_t now = 100 * ms;
+    for (int i = 0; i < 10; ++i)
+        now = watchdog.get_deadline(), watchdog.skip(now);
+
+    FZ_EXPECT(watchdog.get_stats().nb_checks == checks, "%u checks, expected %u", watchdog.get_stats().nb_checks, checks);
+    FZ_EXPECT(watchdog.get_deadline() - now == CmuWatchdog::MaxInterval, "gated interval %lu", watchdog.get_deadline() - now);
+
+    // The latency of a reset is measured from the last check that took place
+    now += 500 * ms;
+    watchdog.arm(now);
+    watchdog.report(now, true);
+    FZ_EXPECT(watchdog.get_stats().max_latency_us == (now - 100 * ms) / 1000, "latency %lu us",
+        watchdog.get_stats().max_latency_us);
+}
+
+// Commits get a single full check, and the checks keep backing off even with a commit every second
+void check_verify() {
+    CmuWatchdog watchdog;
+    watchdog.arm(0);
+
+    std::uint64_t now = 0;
+    for (int i = 0; i < 128; ++i)
+        now = watchdog.get_deadline(), watchdog.report(now, false);
+
+    auto checks = watchdog.get_stats().nb_checks;
+    for (int s = 0; s < 60; ++s) {
+        auto commit = now + 1000 * ms;
+        while (watchdog.get_deadline() < commit)
+            now = watchdog.get_deadline(), watchdog.report(now, false);
+
+        now = commit;
+        watchdog.verify(now);
+        FZ_EXPECT(watchdog.get_deadline() <= now + CmuWatchdog::MinInterval, "verification at %lu", watchdog.get_deadline() - now);
+
+        now = watchdog.get_deadline();
+        FZ_EXPECT(watchdog.is_full_check(now), "partial verification");
+        watchdog.report(now, false);
+        FZ_EXPECT(!watchdog.is_full_check(now), "verification not cleared");
+    }
+
+    // One verification and about one periodic check per commit, a burst would check every frame
+    auto nb = watchdog.get_stats().nb_checks - checks;
+    FZ_EXPECT(nb <= 2 * 60, "%u checks over a minute", nb);
+}
+
+} // namespace
+
+int main() {
+    check_backoff();
+    check_skip();
+    check_verify();
+
+    return test::result("watchdog");
+}
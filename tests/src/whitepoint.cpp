@@ -0,0 +1,49 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <algorithm>
+
+#include <common.hpp>
+
+#include "test.hpp"
+
+using namespace fz;
+
+// The table lookup replaces the formula followed by the degamma of the sysmodule, the difference must stay
+// within one LSB of the QS1.8 csc coefficients it ends up in, over the whole temperature range
+int main() {
+    constexpr float qs18_lsb = 1.0f / 256.0f;
+
+    float max_error = 0.0f;
+    for (Temperature temp = MIN_TEMP; temp <= MAX_TEMP; ++temp) {
+        auto [r, g, b]    = whitepoint(temp);
+        auto [lr, lg, lb] = whitepoint_linear(temp);
+
+        std::array expected = { degamma(r, DEFAULT_GAMMA), degamma(g, DEFAULT_GAMMA), degamma(b, DEFAULT_GAMMA) },
+            actual = { lr, lg, lb };
+
+        for (std::size_t i = 0; i < expected.size(); ++i) {
+            auto error = std::abs(expected[i] - actual[i]);
+            max_error = std::max(max_error, error);
+            FZ_EXPECT(error <= qs18_lsb, "%u°K channel %zu: table %f, formula %f", temp, i, actual[i], expected[i]);
+        }
+    }
+
+    std::printf("whitepoint_linear: max error %.3g (%.3f QS1.8 LSB)\n", max_error, max_error / qs18_lsb);
+    return test::result("whitepoint");
+}
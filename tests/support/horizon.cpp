@@ -0,0 +1,146 @@
+// Copyright (c) 2024 averne
+//
+// This file is part of Fizeau.
+//
+// Fizeau is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Fizeau is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Fizeau.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <array>
+#include <memory>
+
+#include <switch.h>
+#include <omm.h>
+
+namespace fz::test {
+
+namespace {
+
+struct MmioRegion {
+    u64 base = 0, size = 0;
+    std::unique_ptr<u32[]> mem;
+};
+
+std::array<MmioRegion, 4> mmio_regions;
+
+// Indexed by handle, 0 being INVALID_HANDLE
+std::array<bool, 64> events_signaled;
+Handle next_event = 1;
+
+Handle create_event() {
+    if (next_event >= events_signaled.size())
+        diagAbortWithResult(MAKERESULT(1, 1));
+
+    events_signaled[next_event] = false;
+    return next_event++;
+}
+
+MmioRegion *find_region(u64 addr) {
+    for (auto &region: mmio_regions) {
+        if (region.mem && (addr >= region.base) && (addr < region.base + region.size))
+            return &region;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+u32 *mmio(u64 phys_addr) {
+    auto *region = find_region(phys_addr);
+    return region ? region->mem.get() + (phys_addr - region->base) / sizeof(u32) : nullptr;
+}
+
+bool is_signaled(Handle handle) {
+    return (handle < events_signaled.size()) && events_signaled[handle];
+}
+
+} // namespace fz::test
+
+void diagAbortWithResult(Result rc) {
+    std::printf("Aborted with result %#x\n", rc);
+    std::abort();
+}
+
+Result svcQueryMemoryMapping(u64 *virtaddr, u64 *out_size, u64 physaddr, u64 size) {
+    using namespace fz::test;
+
+    auto *region = find_region(physaddr);
+    if (!region) {
+        for (auto &r: mmio_regions) {
+            if (!r.mem) {
+                r = { physaddr, size, std::make_unique<u32[]>(size / sizeof(u32)) };
+                region = &r;
+                break;
+            }
+        }
+    }
+
+    if (!region)
+        return MAKERESULT(1, 1);
+
+    *virtaddr = reinterpret_cast<u64>(mmio(physaddr)), *out_size = size;
+    return 0;
+}
+
+Result eventCreate(Event *t, bool autoclear) {
+    auto handle = fz::test::create_event();
+    *t = { handle, handle, autoclear };
+    return 0;
+}
+
+void eventClose(Event *t) {
+    *t = {};
+}
+
+Result eventFire(Event *t) {
+    fz::test::events_signaled[t->wevent] = true;
+    return 0;
+}
+
+Result eventClear(Event *t) {
+    fz::test::events_signaled[t->revent] = false;
+    return 0;
+}
+
+Result insrGetLastTick(u32, u64 *tick) {
+    *tick = fz::test::last_input_tick;
+    return 0;
+}
+
+Result insrGetReadableEvent(u32, Event *out) {
+    return eventCreate(out, false);
+}
+
+Result ommGetOperationMode(OmmOperationMode *mode) {
+    *mode = fz::test::operation_mode;
+    return 0;
+}
+
+Result ommGetOperationModeChangeEvent(Event *out, bool autoclear) {
+    return eventCreate(out, autoclear);
+}
+
+Result nvOpen(u32 *fd, const char *) {
+    static u32 next_fd = 1;
+    *fd = next_fd++;
+    return 0;
+}
+
+Result nvClose(u32) {
+    return 0;
+}
+
+Result nvIoctl(u32 fd, u32 request, void *argp) {
+    return fz::test::nv_ioctl ? fz::test::nv_ioctl(fd, request, argp) : 0;
+}